@@ -0,0 +1,166 @@
+#include "input.h"
+#include "wfc.h"
+#include <chrono>
+#include <cstring>
+#include <iomanip>
+#include <thread>
+#include <opencv2/opencv.hpp>
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+using namespace wfc;
+
+/*
+ * Compares the throughput of every cell layout on growing boards. Every run
+ * uses the same seed and frontier ordering, which doesn't depend on the layout,
+ * so all layouts make exactly the same choices and only the memory access
+ * pattern differs. Runs stop when the board is done or the time budget runs out.
+ *
+ * Cache references and misses of the generating thread are read from the
+ * hardware counters on Linux, and shown as n/a where the CPU or kernel doesn't
+ * expose them (as in many VMs). Other events can be measured from outside, one
+ * layout at a time:
+ *   perf stat -e cache-references,cache-misses bin/bench_layout 4096 5 row_major
+ *
+ * Usage: bench_layout {size | all} {seconds | 60} {layout | all} {bitmask | adjacency}
+ */
+
+static const int SIZES[] = {256, 1024, 4096};
+
+enum class CacheEvent { REFERENCES, MISSES };
+
+/*
+ * Counts a cache event on the calling thread, if the system allows it.
+ */
+class CacheCounter {
+public:
+	explicit CacheCounter(const CacheEvent event) {
+#ifdef __linux__
+		perf_event_attr attr;
+		memset(&attr, 0, sizeof(attr));
+		attr.size = sizeof(attr);
+		attr.type = PERF_TYPE_HARDWARE;
+		attr.config = event == CacheEvent::MISSES ? PERF_COUNT_HW_CACHE_MISSES : PERF_COUNT_HW_CACHE_REFERENCES;
+		attr.disabled = 1;
+		attr.exclude_kernel = 1;
+		attr.exclude_hv = 1;
+		fd_ = syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+#endif
+	}
+
+	~CacheCounter() {
+#ifdef __linux__
+		if (fd_ >= 0) close(fd_);
+#endif
+	}
+
+	bool valid() const { return fd_ >= 0; }
+
+	void start() {
+#ifdef __linux__
+		if (!valid()) return;
+		ioctl(fd_, PERF_EVENT_IOC_RESET, 0);
+		ioctl(fd_, PERF_EVENT_IOC_ENABLE, 0);
+#endif
+	}
+
+	/*
+	 * Returns the count since 'start', or -1 if the counter isn't available.
+	 */
+	long long stop() {
+		long long count = -1;
+#ifdef __linux__
+		if (!valid()) return -1;
+		ioctl(fd_, PERF_EVENT_IOC_DISABLE, 0);
+		if (read(fd_, &count, sizeof(count)) != sizeof(count)) count = -1;
+#endif
+		return count;
+	}
+
+private:
+	int fd_ = -1;
+};
+
+static std::string format_count(const long long count) {
+	return count < 0 ? "n/a" : std::to_string(count);
+}
+
+int main(int argc, char** argv) {
+	const int only_size = argc > 1 ? atoi(argv[1]) : 0;
+	const double seconds = argc > 2 ? atof(argv[2]) : 60.0;
+	const std::string only_layout = argc > 3 ? argv[3] : "all";
+	const bool adjacency = argc > 4 && std::string(argv[4]) == "adjacency";
+	const Propagation propagation = adjacency ? Propagation::ADJACENCY : Propagation::BITMASK;
+
+	// The smallest rule set, so the largest board still fits in memory. Adjacency
+	// propagation needs about 6 GB for it at 4096 x 4096.
+	const char dim = 2;
+	PatternSet patterns;
+	std::vector<int> counts;
+	load_patterns("tiles/red/", dim, true, std::thread::hardware_concurrency(), patterns, counts);
+
+	std::vector<Pair> overlays;
+	generate_neighbor_overlay(overlays);
+	std::vector<std::vector<int>> fit_table;
+	generate_fit_table(patterns, overlays, dim, fit_table);
+
+	CacheCounter cache_references(CacheEvent::REFERENCES);
+	CacheCounter cache_misses(CacheEvent::MISSES);
+
+	std::cout << std::left << std::setw(8) << "size" << std::setw(12) << "layout"
+		<< std::setw(14) << "collapsed" << std::setw(14) << "positions/s" << std::setw(16) << "cache refs"
+		<< std::setw(16) << "cache misses" << "contradictions" << std::endl;
+
+	std::vector<int> observed;
+	for (const int size : SIZES) {
+		if (only_size && size != only_size) continue;
+
+		// The model logs its progress, which would drown out the results. It is
+		// sized for the blocked layouts, which need the most storage, and touches
+		// every page up front, so the first layout measured doesn't pay for page
+		// faults the others skip.
+		std::streambuf* stdout_buf = std::cout.rdbuf(nullptr);
+		Pair shape = Pair(size, size);
+		Model model(shape, patterns.size(), overlays.size(), dim, true,
+			ModelSettings(false, propagation, Ordering::FRONTIER, 4, false, Layout::TILED), -1,
+			WorkspaceOptions(false, true));
+		std::cout.rdbuf(stdout_buf);
+
+		for (int i = 0; i < LAYOUT_COUNT; i++) {
+			const Layout layout = static_cast<Layout>(i);
+			if (only_layout != "all" && only_layout != layout_name(layout)) continue;
+
+			model.settings = ModelSettings(false, propagation, Ordering::FRONTIER, 4, false, layout);
+
+			std::cout.rdbuf(nullptr);
+			// Clearing the board is not part of the measurement.
+			srand(1);
+			model.start(fit_table);
+			const auto start = Clock::now();
+			cache_references.start();
+			cache_misses.start();
+			model.resume(overlays, counts, fit_table,
+				start + std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(seconds)));
+			const long long misses = cache_misses.stop();
+			const long long references = cache_references.stop();
+			const double elapsed = std::chrono::duration<double>(Clock::now() - start).count();
+			std::cout.rdbuf(stdout_buf);
+
+			model.get_observed(observed);
+			long decided = 0;
+			for (const int pattern : observed)
+				decided += pattern >= 0;
+
+			std::cout << std::left << std::setw(8) << size << std::setw(12) << layout_name(layout)
+				<< std::setw(14) << decided << std::setw(14) << std::fixed << std::setprecision(0) << decided / elapsed
+				<< std::setw(16) << format_count(references) << std::setw(16) << format_count(misses)
+				<< model.count_contradictions() << std::endl;
+		}
+	}
+
+	return 0;
+}
@@ -0,0 +1,81 @@
+#include "input.h"
+#include "wfc.h"
+#include <chrono>
+#include <iomanip>
+#include <thread>
+#include <opencv2/opencv.hpp>
+
+using namespace wfc;
+
+/*
+ * Compares the speed and contradiction rate of every collapse ordering on the
+ * bundled tile sets (the same cases as 'make test').
+ *
+ * Usage: bench_ordering {runs | 10} {size | 64}
+ */
+
+struct BenchCase {
+	const char* tiles_dir;
+	int dim;
+	bool rotate;
+	bool periodic;
+};
+
+static const BenchCase CASES[] = {
+	{"tiles/red/", 2, true, true},
+	{"tiles/spirals/", 3, true, true},
+	{"tiles/bricks/", 3, false, true},
+	{"tiles/dungeons/", 3, false, true},
+	{"tiles/paths/", 3, false, true},
+};
+
+int main(int argc, char** argv) {
+	const int runs = argc > 1 ? atoi(argv[1]) : 10;
+	const int size = argc > 2 ? atoi(argv[2]) : 64;
+
+	std::vector<Pair> overlays;
+	generate_neighbor_overlay(overlays);
+
+	std::cout << std::left << std::setw(18) << "tiles" << std::setw(16) << "ordering"
+		<< std::setw(12) << "ms/run" << std::setw(16) << "failed runs" << "contradictions/run" << std::endl;
+
+	for (const BenchCase& bench : CASES) {
+		PatternSet patterns;
+		std::vector<int> counts;
+		load_patterns(bench.tiles_dir, bench.dim, bench.rotate, std::thread::hardware_concurrency(), patterns, counts);
+
+		std::vector<std::vector<int>> fit_table;
+		generate_fit_table(patterns, overlays, bench.dim, fit_table);
+
+		// The model logs its progress, which would drown out the results.
+		std::streambuf* stdout_buf = std::cout.rdbuf(nullptr);
+		Pair shape = Pair(size, size);
+		Model model(shape, patterns.size(), overlays.size(), bench.dim, bench.periodic);
+		std::cout.rdbuf(stdout_buf);
+
+		for (int i = 0; i < ORDERING_COUNT; i++) {
+			model.settings.ordering = static_cast<Ordering>(i);
+
+			int failed = 0, contradictions = 0;
+			double total_ms = 0;
+			for (int run = 0; run < runs; run++) {
+				std::cout.rdbuf(nullptr);
+				const auto start = std::chrono::steady_clock::now();
+				model.generate(overlays, counts, fit_table);
+				total_ms += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+				std::cout.rdbuf(stdout_buf);
+
+				const int found = model.count_contradictions();
+				contradictions += found;
+				failed += found > 0;
+			}
+
+			std::cout << std::left << std::setw(18) << bench.tiles_dir << std::setw(16) << ordering_name(model.settings.ordering)
+				<< std::setw(12) << std::fixed << std::setprecision(2) << total_ms / runs
+				<< std::setw(16) << (std::to_string(failed) + "/" + std::to_string(runs))
+				<< static_cast<double>(contradictions) / runs << std::endl;
+		}
+	}
+
+	return 0;
+}
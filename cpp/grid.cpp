@@ -0,0 +1,192 @@
+#include "grid.h"
+#include <fstream>
+
+namespace wfc
+{
+	static const char GRID_MAGIC[4] = {'W', 'F', 'C', 'G'};
+	static const uint8_t GRID_VERSION = 1;
+
+	static void write_uint(std::ostream &out, uint64_t val, int bytes) {
+		for (int i = 0; i < bytes; i++)
+			out.put(static_cast<char>((val >> (8 * i)) & 0xff));
+	}
+
+	static bool read_uint(std::istream &in, uint64_t &val, int bytes) {
+		val = 0;
+		for (int i = 0; i < bytes; i++) {
+			const int byte = in.get();
+			if (byte == EOF) return false;
+			val |= static_cast<uint64_t>(byte) << (8 * i);
+		}
+		return true;
+	}
+
+	static void write_varint(std::ostream &out, uint64_t val) {
+		while (val >= 0x80) {
+			out.put(static_cast<char>((val & 0x7f) | 0x80));
+			val >>= 7;
+		}
+		out.put(static_cast<char>(val));
+	}
+
+	static bool read_varint(std::istream &in, uint64_t &val) {
+		val = 0;
+		for (int shift = 0; shift < 64; shift += 7) {
+			const int byte = in.get();
+			if (byte == EOF) return false;
+			val |= static_cast<uint64_t>(byte & 0x7f) << shift;
+			if (!(byte & 0x80)) return true;
+		}
+		return false;
+	}
+
+	static uint64_t hash_bytes(uint64_t hash, const uchar* data, size_t len) {
+		// FNV-1a
+		for (size_t i = 0; i < len; i++) {
+			hash ^= data[i];
+			hash *= 1099511628211ull;
+		}
+		return hash;
+	}
+
+	static uint64_t hash_int(uint64_t hash, int64_t val) {
+		uchar bytes[8];
+		for (int i = 0; i < 8; i++) bytes[i] = (val >> (8 * i)) & 0xff;
+		return hash_bytes(hash, bytes, 8);
+	}
+
+	GridHeader::GridHeader(uint64_t rule_set_hash, Pair shape, int num_patterns, char dim, int flags) :
+	rule_set_hash(rule_set_hash), shape(shape), num_patterns(num_patterns), dim(dim), flags(flags) {}
+
+	uint64_t hash_rule_set(const PatternSet &patterns, const std::vector<int> &counts,
+		const std::vector<Pair> &overlays, const char dim) {
+		uint64_t hash = 14695981039346656037ull;
+		hash = hash_int(hash, dim);
+		hash = hash_int(hash, patterns.size());
+		const int pixels = patterns.dim * patterns.dim;
+		for (size_t patt = 0; patt < patterns.size(); patt++) {
+			for (int i = 0; i < pixels; i++) {
+				const BGR& color = patterns.palette[patterns.index_at(patterns.pattern(patt), i)];
+				const uchar bytes[3] = {color.b, color.g, color.r};
+				hash = hash_bytes(hash, bytes, 3);
+			}
+		}
+		for (int count : counts)
+			hash = hash_int(hash, count);
+		for (const Pair &overlay : overlays) {
+			hash = hash_int(hash, overlay.x);
+			hash = hash_int(hash, overlay.y);
+		}
+		return hash;
+	}
+
+	int grid_index_bytes(const int num_patterns) {
+		// Pattern indices are stored shifted up by one to make room for uncollapsed.
+		if (num_patterns < 0x100) return 1;
+		if (num_patterns < 0x10000) return 2;
+		return 4;
+	}
+
+	bool write_grid(std::ostream &out, const GridHeader &header, const std::vector<int> &grid) {
+		const int width = header.shape.x;
+		const int size = header.shape.size;
+		const int bytes = grid_index_bytes(header.num_patterns);
+		const uint64_t mask = (bytes == 4) ? 0xffffffffull : (1ull << (8 * bytes)) - 1;
+		if (static_cast<int>(grid.size()) != size) return false;
+
+		out.write(GRID_MAGIC, 4);
+		write_uint(out, GRID_VERSION, 1);
+		write_uint(out, header.flags, 1);
+		write_uint(out, bytes, 1);
+		write_uint(out, header.dim, 1);
+		write_uint(out, header.shape.x, 4);
+		write_uint(out, header.shape.y, 4);
+		write_uint(out, header.num_patterns, 4);
+		write_uint(out, header.rule_set_hash, 8);
+
+		uint64_t run_val = 0;
+		uint64_t run_len = 0;
+		for (int i = 0; i < size; i++) {
+			uint64_t val = static_cast<uint64_t>(grid[i] + 1);
+			if (header.flags & GRID_DELTA) {
+				const uint64_t above = (i >= width) ? static_cast<uint64_t>(grid[i - width] + 1) : 0;
+				val = (val - above) & mask;
+			}
+
+			if (!(header.flags & GRID_RLE)) {
+				write_uint(out, val, bytes);
+			} else if (run_len > 0 && val == run_val) {
+				run_len++;
+			} else {
+				if (run_len > 0) {
+					write_varint(out, run_len);
+					write_uint(out, run_val, bytes);
+				}
+				run_val = val;
+				run_len = 1;
+			}
+		}
+		if (run_len > 0) {
+			write_varint(out, run_len);
+			write_uint(out, run_val, bytes);
+		}
+		return out.good();
+	}
+
+	bool write_grid(const std::string &filename, const GridHeader &header, const std::vector<int> &grid) {
+		std::ofstream out(filename, std::ios::binary);
+		return out && write_grid(out, header, grid);
+	}
+
+	bool read_grid(std::istream &in, GridHeader &header, std::vector<int> &grid) {
+		char magic[4];
+		if (!in.read(magic, 4) || !std::equal(magic, magic + 4, GRID_MAGIC)) return false;
+
+		uint64_t version, flags, bytes, dim, width, height, num_patterns, hash;
+		if (!(read_uint(in, version, 1) && read_uint(in, flags, 1) && read_uint(in, bytes, 1) &&
+			read_uint(in, dim, 1) && read_uint(in, width, 4) && read_uint(in, height, 4) &&
+			read_uint(in, num_patterns, 4) && read_uint(in, hash, 8)))
+			return false;
+		if (version != GRID_VERSION || (bytes != 1 && bytes != 2 && bytes != 4)) return false;
+
+		// Both sides are u32 on disk but the shape is stored in ints, so a corrupt
+		// header could otherwise overflow into a negative or huge size.
+		if (width > INT32_MAX || height > INT32_MAX || width * height > INT32_MAX ||
+			num_patterns > INT32_MAX)
+			return false;
+
+		header = GridHeader(hash, Pair(width, height), num_patterns, dim, flags);
+		const int size = header.shape.size;
+		const uint64_t mask = (bytes == 4) ? 0xffffffffull : (1ull << (8 * bytes)) - 1;
+		grid.resize(size);
+
+		uint64_t run_val = 0;
+		uint64_t run_len = 0;
+		for (int i = 0; i < size; i++) {
+			uint64_t val;
+			if (!(flags & GRID_RLE)) {
+				if (!read_uint(in, val, bytes)) return false;
+			} else {
+				if (run_len == 0 && !(read_varint(in, run_len) && read_uint(in, run_val, bytes) && run_len > 0))
+					return false;
+				val = run_val;
+				run_len--;
+			}
+
+			if (flags & GRID_DELTA) {
+				const uint64_t above = (i >= header.shape.x) ? static_cast<uint64_t>(grid[i - header.shape.x] + 1) : 0;
+				val = (val + above) & mask;
+			}
+			// Stored values are offset by one, so anything past N would decode to an
+			// index out of range, or wrap around below -1 for 4 byte values.
+			if (val > num_patterns) return false;
+			grid[i] = static_cast<int>(val) - 1;
+		}
+		return true;
+	}
+
+	bool read_grid(const std::string &filename, GridHeader &header, std::vector<int> &grid) {
+		std::ifstream in(filename, std::ios::binary);
+		return in && read_grid(in, header, grid);
+	}
+}
@@ -0,0 +1,76 @@
+#pragma once
+#include <cstdint>
+#include <iostream>
+#include <string>
+#include <vector>
+#include "pattern_set.h"
+
+/* Grid file layout (all integers little-endian)
+	magic         "WFCG"
+	version       u8
+	flags         u8  (GridFlags)
+	index_bytes   u8  (1, 2 or 4)
+	dim           u8
+	width         u32 (WX)
+	height        u32 (WY)
+	num_patterns  u32 (N)
+	rule_set_hash u64
+	body          [WY, WX] values of 'index_bytes' each, where 0 is an
+	              uncollapsed position and 'i + 1' is pattern 'i'. With GRID_RLE
+	              the body is a sequence of (varint run length, value) pairs.
+*/
+namespace wfc
+{
+	/**
+	 * \brief Optional encodings of a grid body. Can be combined.
+	 */
+	enum GridFlags {
+		GRID_RAW = 0,
+		GRID_RLE = 1,	// Runs of equal values are stored once with a length.
+		GRID_DELTA = 2	// Values are stored as the difference to the position above.
+	};
+
+	/**
+	 * \brief Describes a stored pattern-index grid and the rule set it indexes into.
+	 */
+	struct GridHeader {
+		uint64_t rule_set_hash;
+		Pair shape;
+		int num_patterns;
+		char dim;
+		int flags;
+
+	public:
+		GridHeader(uint64_t rule_set_hash=0, Pair shape=Pair(), int num_patterns=0, char dim=0,
+			int flags=GRID_RAW);
+	};
+
+	/**
+	 * \return A hash identifying a rule set (patterns, frequency counts, overlays
+	 * and dim). Grids store this so consumers can check they render with the
+	 * patterns the grid was generated from. Patterns are hashed by color, so the
+	 * hash does not depend on the order of the palette.
+	 */
+	uint64_t hash_rule_set(const PatternSet &patterns, const std::vector<int> &counts,
+		const std::vector<Pair> &overlays, const char dim);
+
+	/**
+	 * \return The narrowest integer width (in bytes) that can store every pattern
+	 * index of a grid, plus the uncollapsed value.
+	 */
+	int grid_index_bytes(const int num_patterns);
+
+	/**
+	 * \brief Encodes a row-major grid of pattern indices (-1 for uncollapsed, see
+	 * 'Model::get_observed') to the stream.
+	 */
+	bool write_grid(std::ostream &out, const GridHeader &header, const std::vector<int> &grid);
+	bool write_grid(const std::string &filename, const GridHeader &header, const std::vector<int> &grid);
+
+	/**
+	 * \brief Decodes a grid written by 'write_grid'. Returns false if the stream is
+	 * not a valid grid.
+	 */
+	bool read_grid(std::istream &in, GridHeader &header, std::vector<int> &grid);
+	bool read_grid(const std::string &filename, GridHeader &header, std::vector<int> &grid);
+}
@@ -1,4 +1,37 @@
 #include "input.h"
+#include <algorithm>
+#include <condition_variable>
+#include <cstring>
+#include <mutex>
+#include <thread>
+
+/**
+ * \brief The patterns found in a single image, waiting to be merged.
+ */
+struct ImagePatterns {
+	wfc::PatternSet patterns;
+	std::vector<int> counts;
+	bool valid = true;
+	bool ready = false;
+};
+
+/**
+ * \brief Rebuilds 'index' for every pattern in the set.
+ */
+static void index_patterns(const wfc::PatternSet &patterns, PatternIndex &index) {
+	index.clear();
+	for (size_t i = 0; i < patterns.size(); i++)
+		index.emplace(hash_pattern(patterns.pattern(i), patterns.pattern_bytes()), i);
+}
+
+/**
+ * \brief Switches the set to two byte palette indices, which changes every
+ * pattern's hash.
+ */
+static void widen_patterns(wfc::PatternSet &patterns, PatternIndex &index) {
+	patterns.widen();
+	index_patterns(patterns, index);
+}
 
 void load_tiles(std::string dirname, std::vector<cv::Mat> &out){
 	std::vector<cv::String> filenames;
@@ -9,71 +42,189 @@ void load_tiles(std::string dirname, std::vector<cv::Mat> &out){
 	}
 }
 
-void create_waveforms(const std::vector<cv::Mat> &templates, const int dim, 
+bool load_patterns(std::string dirname, const int dim, const bool rotate_patterns,
+	const int num_threads, wfc::PatternSet &patterns, std::vector<int> &counts) {
+	std::vector<cv::String> filenames;
+	cv::glob(dirname + "/*.png", filenames, false);
+	const size_t count = filenames.size();
+	const size_t workers = std::max(1, num_threads);
+
+	// At most 'window' images are decoded or waiting to be merged at once, which
+	// bounds peak memory regardless of how many images there are.
+	const size_t window = 2 * workers;
+	std::vector<ImagePatterns> slots(window);
+	size_t next_image = 0, next_merge = 0;
+	std::mutex mutex;
+	std::condition_variable merged;
+	bool valid = true;
+
+	if (patterns.empty()) patterns.dim = dim;
+	PatternIndex index;
+	index_patterns(patterns, index);
+	wfc::PaletteLookup lookup;
+	wfc::index_palette(patterns.palette, lookup);
+	std::vector<int> to_shared;
+	std::vector<uint8_t> remapped;
+
+	auto worker = [&]() {
+		std::unique_lock<std::mutex> lock(mutex);
+		while (true) {
+			merged.wait(lock, [&]() { return next_image >= count || next_image < next_merge + window; });
+			if (next_image >= count) return;
+			const size_t image = next_image++;
+			lock.unlock();
+
+			// Decode and deduplicate this image's patterns without holding the lock.
+			ImagePatterns local;
+			local.patterns.dim = dim;
+			PatternIndex local_index;
+			{
+				// Unreadable images decode as empty and are skipped. Nothing may throw
+				// here, since an exception on a worker thread would terminate the process.
+				const cv::Mat tile = cv::imread(filenames[image]);
+				if (!tile.empty())
+					local.valid = extract_patterns(tile, dim, rotate_patterns, local.patterns, local.counts, local_index);
+			}
+			local.ready = true;
+
+			// Merge every finished image in filename order, so the pattern order does
+			// not depend on thread scheduling.
+			lock.lock();
+			slots[image % window] = std::move(local);
+			while (next_merge < count && slots[next_merge % window].ready) {
+				ImagePatterns &done = slots[next_merge % window];
+
+				// Translate the image's palette into the shared one. Colors are added in
+				// the order the image first used them, same as extracting serially.
+				to_shared.resize(done.patterns.palette.size());
+				for (size_t color = 0; color < to_shared.size() && valid; color++) {
+					to_shared[color] = wfc::palette_index(patterns.palette, lookup, done.patterns.palette[color]);
+					valid = to_shared[color] >= 0;
+				}
+				valid = valid && done.valid;
+				if (valid && patterns.palette.size() > wfc::NARROW_PALETTE_SIZE && patterns.index_bytes == 1)
+					widen_patterns(patterns, index);
+
+				const size_t found = done.patterns.size();
+				remapped.resize(patterns.pattern_bytes());
+				for (size_t i = 0; i < found && valid; i++) {
+					const uint8_t* pattern = done.patterns.pattern(i);
+					for (int p = 0; p < dim * dim; p++)
+						patterns.set_index(remapped.data(), p, to_shared[done.patterns.index_at(pattern, p)]);
+					add_pattern(remapped.data(), patterns, counts, index, done.counts[i]);
+				}
+				done = ImagePatterns();
+				next_merge++;
+			}
+			merged.notify_all();
+		}
+	};
+
+	std::vector<std::thread> threads;
+	for (size_t i = 1; i < workers; i++)
+		threads.emplace_back(worker);
+	worker();
+	for (auto& thread : threads)
+		thread.join();
+	return valid;
+}
+
+bool create_waveforms(const std::vector<cv::Mat> &templates, const int dim, 
 	const bool rotate_patterns, 
-	std::vector<cv::Mat> &patterns, std::vector<int> &counts) {
+	wfc::PatternSet &patterns, std::vector<int> &counts) {
+	if (patterns.empty()) patterns.dim = dim;
+	PatternIndex index;
+	index_patterns(patterns, index);
+
 	for (const auto& tile : templates) {
-		const int height = tile.rows;
-		const int width = tile.cols;
-
-		// Add all (D x D) subarrays and (if requested) all it's rotations.
-		for (int col = 0; col < width + 1 - dim; col++) {
-			for (int row = 0; row < height + 1 - dim; row++) {
-				auto pattern = tile(cv::Rect(col, row, dim, dim));
-				add_pattern(pattern, patterns, counts);
-				if (rotate_patterns) {
-					cv::Mat cpy;
-					cv::rotate(pattern, cpy, cv::ROTATE_90_COUNTERCLOCKWISE);
-					add_pattern(cpy, patterns, counts);
-					cv::Mat cpy1;
-					cv::rotate(pattern, cpy1, cv::ROTATE_180);
-					add_pattern(cpy1, patterns, counts);
-					cv::Mat cpy2;
-					cv::rotate(pattern, cpy2, cv::ROTATE_90_CLOCKWISE);
-					add_pattern(cpy2, patterns, counts);
+		if (!extract_patterns(tile, dim, rotate_patterns, patterns, counts, index))
+			return false;
+	}
+	return true;
+}
+
+/**
+ * \brief Stores the (D x D) pattern, of 'bytes' bytes per pixel, rotated by 90
+ * degrees counterclockwise in 'out'.
+ */
+static void rotate_pattern(const uint8_t* pattern, const int dim, const int bytes, uint8_t* out) {
+	for (int row = 0; row < dim; row++) {
+		for (int col = 0; col < dim; col++)
+			memcpy(&out[(row * dim + col) * bytes], &pattern[(col * dim + (dim - 1 - row)) * bytes], bytes);
+	}
+}
+
+bool extract_patterns(const cv::Mat &tile, const int dim, const bool rotate_patterns,
+	wfc::PatternSet &patterns, std::vector<int> &counts, PatternIndex &index) {
+	const int height = tile.rows;
+	const int width = tile.cols;
+	if (tile.empty()) return true;
+
+	std::vector<uint16_t> indices;
+	if (!wfc::quantize_image(tile, patterns.palette, indices))
+		return false;
+	if (patterns.palette.size() > wfc::NARROW_PALETTE_SIZE && patterns.index_bytes == 1)
+		widen_patterns(patterns, index);
+
+	// Add all (D x D) subarrays and (if requested) all it's rotations.
+	std::vector<uint8_t> pattern(patterns.pattern_bytes()), rotated(patterns.pattern_bytes());
+	for (int col = 0; col < width + 1 - dim; col++) {
+		for (int row = 0; row < height + 1 - dim; row++) {
+			for (int r = 0; r < dim; r++) {
+				for (int c = 0; c < dim; c++)
+					patterns.set_index(pattern.data(), r * dim + c, indices[(row + r) * width + col + c]);
+			}
+			add_pattern(pattern.data(), patterns, counts, index);
+			if (rotate_patterns) {
+				// Counterclockwise by 90, 180 and 270 degrees.
+				for (int turn = 0; turn < 3; turn++) {
+					rotate_pattern(pattern.data(), dim, patterns.index_bytes, rotated.data());
+					add_pattern(rotated.data(), patterns, counts, index);
+					pattern.swap(rotated);
 				}
 			}
 		}
 	}
+	return true;
 }
 
-void add_pattern(const cv::Mat &pattern, std::vector<cv::Mat> &patterns, std::vector<int> &counts) {
+void add_pattern(const uint8_t* pattern, wfc::PatternSet &patterns, std::vector<int> &counts) {
 	const size_t curr_patt_count = patterns.size();
 	for (size_t i = 0; i < curr_patt_count; i++) {
-		if (patterns_equal(pattern, patterns[i])) {
+		if (patterns_equal(pattern, patterns.pattern(i), patterns.pattern_bytes())) {
 			counts[i] += 1;
 			return;
 		}
 	}
-	patterns.push_back(pattern);
+	patterns.add(pattern);
 	counts.push_back(1);
 }
 
-bool patterns_equal(const cv::Mat &patt1, const cv::Mat &patt2) {
-	CV_Assert(patt1.depth() == patt2.depth() &&
-		patt1.depth() == CV_8U &&
-		patt1.channels() == patt2.channels() &&
-		patt1.cols == patt2.cols && patt1.rows == patt2.rows);
-	const int channels = patt1.channels();
-	int n_rows = patt1.rows;
-	int n_cols = patt1.cols * channels;
-
-	if (patt1.isContinuous() && patt2.isContinuous()) {
-		n_cols *= n_rows;
-		n_rows = 1;
+void add_pattern(const uint8_t* pattern, wfc::PatternSet &patterns, std::vector<int> &counts,
+	PatternIndex &index, const int count) {
+	const uint64_t hash = hash_pattern(pattern, patterns.pattern_bytes());
+	auto range = index.equal_range(hash);
+	for (auto it = range.first; it != range.second; ++it) {
+		if (patterns_equal(pattern, patterns.pattern(it->second), patterns.pattern_bytes())) {
+			counts[it->second] += count;
+			return;
+		}
 	}
+	index.emplace(hash, patterns.size());
+	patterns.add(pattern);
+	counts.push_back(count);
+}
 
-	// Checks each pixel value for equality
-	int i, j;
-	const uchar* p1; const uchar* p2;
-	bool matching = true;
-	for (i = 0; i < n_rows && matching; i++) {	
-		p1 = patt1.ptr<uchar>(i);
-		p2 = patt2.ptr<uchar>(i);
-		for (j = 0; j < n_cols && matching; j++) {
-			matching = p1[j] == p2[j];
-		}
+uint64_t hash_pattern(const uint8_t* patt, const size_t bytes) {
+	// FNV-1a
+	uint64_t hash = 14695981039346656037ull;
+	for (size_t i = 0; i < bytes; i++) {
+		hash ^= patt[i];
+		hash *= 1099511628211ull;
 	}
+	return hash;
+}
 
-	return matching;
-}
\ No newline at end of file
+bool patterns_equal(const uint8_t* patt1, const uint8_t* patt2, const size_t bytes) {
+	return memcmp(patt1, patt2, bytes) == 0;
+}
@@ -1,28 +1,74 @@
 #pragma once
 
 #include <opencv2/opencv.hpp>
+#include <cstdint>
+#include <unordered_map>
 #include <vector>
+#include "pattern_set.h"
+
+/**
+ * \brief Maps pattern hashes to their indices in a pattern set, so duplicates can
+ * be found without comparing against every stored pattern.
+ */
+typedef std::unordered_multimap<uint64_t, int> PatternIndex;
 
 /**
  * \brief Stores all png images in a directory to a vector.
  */
 void load_tiles(std::string dirname, std::vector<cv::Mat> &out);
 
+/**
+ * \brief Decodes all png images in a directory on 'num_threads' worker threads and
+ * adds their (D x D) tiles to the set of patterns/states. Images are streamed:
+ * each one is released as soon as its patterns are extracted, and per-image
+ * results are merged in filename order, so the output (including the palette)
+ * matches 'load_tiles' followed by 'create_waveforms'.
+ *
+ * \return False if the images use more than MAX_PALETTE_SIZE colors.
+ */
+bool load_patterns(std::string dirname, const int dim, const bool rotate_patterns,
+	const int num_threads, wfc::PatternSet &patterns, std::vector<int> &counts);
+
 /**
  * \brief Adds all (D x D) tiles in the input image to the internal set of
  * pattern/states. A (5 x 3) input image has 3 (3 x 3) considered tiles.
+ *
+ * \return False if the images use more than MAX_PALETTE_SIZE colors.
  */
-void create_waveforms(const std::vector<cv::Mat> &templates, const int dim, 
+bool create_waveforms(const std::vector<cv::Mat> &templates, const int dim, 
 	const bool rotate_patterns, 
-	std::vector<cv::Mat> &patterns, std::vector<int> &counts);
+	wfc::PatternSet &patterns, std::vector<int> &counts);
+
+/**
+ * \brief Adds all (D x D) tiles of a single image to the set of patterns/states,
+ * using 'index' to find duplicates. The image's colors are added to the
+ * pattern set's palette.
+ *
+ * \return False if the palette would need more than MAX_PALETTE_SIZE colors.
+ */
+bool extract_patterns(const cv::Mat &tile, const int dim, const bool rotate_patterns,
+	wfc::PatternSet &patterns, std::vector<int> &counts, PatternIndex &index);
 
 /**
  * \brief Adds the given (D x D) tile, to the internal set of patterns/states.
  * Duplicates are counted to keep track of the frequencies of unique patterns.
  */
-void add_pattern(const cv::Mat &pattern, std::vector<cv::Mat> &patterns, std::vector<int> &counts);
+void add_pattern(const uint8_t* pattern, wfc::PatternSet &patterns, std::vector<int> &counts);
+
+/**
+ * \brief Adds the given (D x D) tile 'count' times, using 'index' to find
+ * duplicates.
+ */
+void add_pattern(const uint8_t* pattern, wfc::PatternSet &patterns, std::vector<int> &counts,
+	PatternIndex &index, const int count=1);
+
+/**
+ * \return A hash of the pattern's palette indices, which take 'bytes' bytes (see
+ * 'PatternSet::pattern_bytes')
+ */
+uint64_t hash_pattern(const uint8_t* patt, const size_t bytes);
 
 /**
- * \return True if both patterns have the same pixel values
+ * \return True if both patterns have the same palette indices
  */
-bool patterns_equal(const cv::Mat &patt1, const cv::Mat &patt2);
\ No newline at end of file
+bool patterns_equal(const uint8_t* patt1, const uint8_t* patt2, const size_t bytes);
@@ -0,0 +1,17 @@
+#include "layout.h"
+
+namespace wfc
+{
+	CellLayout::CellLayout(Layout layout, Pair shape) : layout(layout), shape(shape) {
+		// Row-major storage has no blocks, so never takes the per-block fast path.
+		if (layout == Layout::ROW_MAJOR) {
+			storage_size_ = shape.size;
+			full_blocks_ = Pair(0, 0);
+		} else {
+			blocks_x_ = (shape.x + BLOCK - 1) / BLOCK;
+			const int blocks_y = (shape.y + BLOCK - 1) / BLOCK;
+			storage_size_ = blocks_x_ * blocks_y * BLOCK * BLOCK;
+			full_blocks_ = Pair(shape.x / BLOCK * BLOCK, shape.y / BLOCK * BLOCK);
+		}
+	}
+}
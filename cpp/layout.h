@@ -0,0 +1,131 @@
+#pragma once
+#include <cstdint>
+#include "wfc_util.h"
+
+namespace wfc
+{
+	/**
+	 * \brief Order in which the positions of a board are stored in memory.
+	 */
+	enum class Layout {
+		/**
+		 * \brief Rows one after another. Vertical neighbors are a full row apart.
+		 */
+		ROW_MAJOR,
+
+		/**
+		 * \brief Square blocks of (CellLayout::BLOCK x CellLayout::BLOCK) positions,
+		 * stored row-major inside each block, with the blocks themselves in
+		 * row-major order. The board is padded to a multiple of the block size.
+		 */
+		TILED,
+
+		/**
+		 * \brief Blocks laid out like TILED, but with the positions inside each block
+		 * stored along a Morton (Z-order) curve. Padding is the same as TILED, so
+		 * long, narrow boards cost no extra storage.
+		 */
+		MORTON
+	};
+
+	/**
+	 * \brief Maps board positions to storage indices for a given layout. Storage
+	 * may contain padding positions that lie outside of the board.
+	 */
+	class CellLayout {
+	public:
+		static const int BLOCK_BITS = 3;
+		static const int BLOCK = 1 << BLOCK_BITS;
+
+		Layout layout;
+		Pair shape;
+
+	private:
+		int blocks_x_ = 0;
+		int storage_size_ = 0;
+		Pair full_blocks_;
+
+	public:
+		CellLayout(Layout layout=Layout::ROW_MAJOR, Pair shape=Pair());
+
+		/**
+		 * \return The number of storage positions, including padding.
+		 */
+		int storage_size() const { return storage_size_; }
+
+		/**
+		 * \return The storage index of the position (x, y).
+		 */
+		inline int index(const Pair &pos) const;
+
+		/**
+		 * \return The position stored at the given index. May lie outside of the
+		 * board for padding positions.
+		 */
+		inline Pair position(const int index) const;
+
+		/**
+		 * \return True if the position is in a block that lies entirely inside of
+		 * the board, so that every neighbor inside the block is a valid position
+		 * and is a fixed storage offset away. Always false for row-major layout.
+		 */
+		inline bool in_full_block(const Pair &pos) const;
+
+		/**
+		 * \return The index of the position within its block.
+		 */
+		inline int block_local(const Pair &pos) const;
+	};
+
+	/**
+	 * \return The bits of x spread out to the even bits of the result.
+	 */
+	inline uint32_t spread_bits(uint32_t x) {
+		x &= 0x0000ffff;
+		x = (x | (x << 8)) & 0x00ff00ff;
+		x = (x | (x << 4)) & 0x0f0f0f0f;
+		x = (x | (x << 2)) & 0x33333333;
+		x = (x | (x << 1)) & 0x55555555;
+		return x;
+	}
+
+	/**
+	 * \return The even bits of x packed together (the inverse of 'spread_bits').
+	 */
+	inline uint32_t compact_bits(uint32_t x) {
+		x &= 0x55555555;
+		x = (x | (x >> 1)) & 0x33333333;
+		x = (x | (x >> 2)) & 0x0f0f0f0f;
+		x = (x | (x >> 4)) & 0x00ff00ff;
+		x = (x | (x >> 8)) & 0x0000ffff;
+		return x;
+	}
+
+	inline int CellLayout::index(const Pair &pos) const {
+		if (layout == Layout::ROW_MAJOR)
+			return pos.y * shape.x + pos.x;
+		const int block = (pos.y >> BLOCK_BITS) * blocks_x_ + (pos.x >> BLOCK_BITS);
+		return (block << (2 * BLOCK_BITS)) | block_local(pos);
+	}
+
+	inline Pair CellLayout::position(const int index) const {
+		if (layout == Layout::ROW_MAJOR)
+			return Pair(index % shape.x, index / shape.x);
+		const int block = index >> (2 * BLOCK_BITS);
+		const int local = index & (BLOCK * BLOCK - 1);
+		const int x = layout == Layout::MORTON ? compact_bits(local) : local & (BLOCK - 1);
+		const int y = layout == Layout::MORTON ? compact_bits(local >> 1) : local >> BLOCK_BITS;
+		return Pair((block % blocks_x_) * BLOCK + x, (block / blocks_x_) * BLOCK + y);
+	}
+
+	inline bool CellLayout::in_full_block(const Pair &pos) const {
+		return pos.x < full_blocks_.x && pos.y < full_blocks_.y;
+	}
+
+	inline int CellLayout::block_local(const Pair &pos) const {
+		const int x = pos.x & (BLOCK - 1), y = pos.y & (BLOCK - 1);
+		if (layout == Layout::MORTON)
+			return spread_bits(x) | (spread_bits(y) << 1);
+		return (y << BLOCK_BITS) | x;
+	}
+}
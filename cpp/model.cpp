@@ -2,33 +2,150 @@
 
 namespace wfc
 {
+	// Number of propagation steps between checks of the deadline and token.
+	static const int INTERRUPT_CHECK_INTERVAL = 1024;
+
+	// Marks a block neighbor that lies outside of the block.
+	static const int NO_BLOCK_OFFSET = INT32_MIN;
+
+	ModelSettings::ModelSettings(bool coalesce_bans, Propagation propagation, Ordering ordering, int window,
+		bool stop_on_contradiction, Layout layout) :
+	coalesce_bans(coalesce_bans), propagation(propagation), ordering(ordering), window(window),
+	stop_on_contradiction(stop_on_contradiction), layout(layout) {}
+
 	Model::Model(Pair &output_shape, const int num_patterns, const int overlay_count, 
-			const char dim, const bool periodic, const int iteration_limit) :
+			const char dim, const bool periodic, const ModelSettings &settings,
+			const int iteration_limit, const WorkspaceOptions &options) :
 	dim(dim), iteration_limit(iteration_limit), num_patterns(num_patterns),
-	overlay_count(overlay_count), wave_shape(output_shape.x + 1 - dim, output_shape.y + 1 - dim),
-	num_patt_2d(num_patterns, num_patterns), periodic_(periodic) {
+	overlay_count(overlay_count), settings(settings), periodic_(periodic),
+	block_offsets_(WorkspaceAllocator<int>(options)), block_overlays_(WorkspaceAllocator<Pair>(options)),
+	propagate_stack_(WorkspaceAllocator<uint32_t>(options)), pending_bans_(WorkspaceAllocator<uint64_t>(options)),
+	queued_(WorkspaceAllocator<char>(options)), wave_masks_(WorkspaceAllocator<uint64_t>(options)),
+	fit_masks_(WorkspaceAllocator<uint64_t>(options)), support_(WorkspaceAllocator<uint64_t>(options)),
+	frontier_(WorkspaceAllocator<uint32_t>(options)), frontier_seen_(WorkspaceAllocator<char>(options)),
+	entropy_(WorkspaceAllocator<int>(options)),
+	waves_(WorkspaceAllocator<char>(options)), observed_(WorkspaceAllocator<int>(options)),
+	compatible_neighbors_(WorkspaceAllocator<int>(options)), initial_compatible_(WorkspaceAllocator<int>(options)) {
 		srand(time(nullptr));
 
 		// Initialize collections.
-		propagate_stack_ = std::vector<Waveform>(wave_shape.size * num_patterns);
-		entropy_ = std::vector<int>(wave_shape.size);
-		waves_ = std::vector<char>(wave_shape.size * num_patterns);
-		observed_ = std::vector<int>(wave_shape.size);
-		compatible_neighbors_ = std::vector<int>(wave_shape.size * num_patterns * overlay_count);
+		resize(output_shape, num_patterns, overlay_count, dim);
 
 		std::cout << "Patterns: " << num_patterns << std::endl;
 		std::cout << "Overlay Count: " << overlay_count << std::endl;
 		std::cout << "Wave Shape: " << wave_shape.y << " x " << wave_shape.x << std::endl;
 	}
 
-	void Model::generate(std::vector<Pair> &overlays, std::vector<int> &counts, std::vector<std::vector<int>> &fit_table) {
+	void Model::resize(Pair &output_shape, const int num_patterns, const int overlay_count,
+			const char dim) {
+		this->dim = dim;
+		this->num_patterns = num_patterns;
+		this->overlay_count = overlay_count;
+		wave_shape = Pair(output_shape.x + 1 - dim, output_shape.y + 1 - dim);
+		num_patt_2d = Pair(num_patterns, num_patterns);
+		ban_words_ = (num_patterns + 63) / 64;
+		size_workspace();
+	}
+
+	void Model::reserve(Pair &output_shape, const int num_patterns, const int overlay_count,
+			const char dim) {
+		const int cells = CellLayout(settings.layout, Pair(output_shape.x + 1 - dim, output_shape.y + 1 - dim)).storage_size();
+		const int words = (num_patterns + 63) / 64;
+		const bool bitmask = settings.propagation == Propagation::BITMASK;
+
+		// 'queued_' keeps stacked positions to one entry each, but individual bans
+		// can reach one entry per state, and an arena can't grow past this later.
+		propagate_stack_.reserve(stacks_positions() ? cells : cells * num_patterns);
+		if (settings.coalesce_bans && !bitmask)
+			pending_bans_.reserve(cells * words);
+		if (settings.coalesce_bans || bitmask)
+			queued_.reserve(cells);
+		if (bitmask) {
+			wave_masks_.reserve(cells * words);
+			fit_masks_.reserve(num_patterns * overlay_count * words);
+			support_.reserve(words);
+		} else {
+			compatible_neighbors_.reserve(cells * num_patterns * overlay_count);
+			initial_compatible_.reserve(num_patterns * overlay_count);
+		}
+		if (settings.ordering == Ordering::FRONTIER) {
+			frontier_.reserve(cells);
+			frontier_seen_.reserve(cells);
+		}
+		entropy_.reserve(cells);
+		waves_.reserve(cells * num_patterns);
+		observed_.reserve(cells);
+		block_offsets_.reserve(CellLayout::BLOCK * CellLayout::BLOCK * overlay_count);
+		block_overlays_.reserve(overlay_count);
+	}
+
+	/**
+	 * \brief Resizes a buffer the current settings use, or frees one they don't.
+	 * Arena-backed buffers are only emptied, since an arena never takes memory
+	 * back before 'Arena::reset', so freeing would leak it on every settings
+	 * change. Keeping them lets switching back reuse the same memory.
+	 */
+	template <typename T>
+	static void size_or_release(workspace_vector<T> &buffer, const size_t size) {
+		if (size == 0 && !buffer.get_allocator().options.arena)
+			workspace_vector<T>(buffer.get_allocator()).swap(buffer);
+		else
+			buffer.resize(size);
+	}
+
+	void Model::size_workspace() {
+		const bool bitmask = settings.propagation == Propagation::BITMASK;
+		layout_ = CellLayout(settings.layout, wave_shape);
+		num_cells_ = layout_.storage_size();
+
+		// Resizing never shrinks capacity, so a smaller or equal shape reuses the
+		// existing buffers in place. Buffers the current settings don't use are
+		// freed, since they can be far larger than the ones in use.
+		const bool frontier = settings.ordering == Ordering::FRONTIER;
+		entropy_.resize(num_cells_);
+		waves_.resize(num_cells_ * num_patterns);
+		observed_.resize(num_cells_);
+		propagate_stack_.clear();
+		size_or_release(pending_bans_, settings.coalesce_bans && !bitmask ? num_cells_ * ban_words_ : 0);
+		size_or_release(queued_, stacks_positions() ? num_cells_ : 0);
+		size_or_release(wave_masks_, bitmask ? num_cells_ * ban_words_ : 0);
+		size_or_release(fit_masks_, bitmask ? num_patterns * overlay_count * ban_words_ : 0);
+		size_or_release(support_, bitmask ? ban_words_ : 0);
+		size_or_release(compatible_neighbors_, bitmask ? 0 : num_cells_ * num_patterns * overlay_count);
+		size_or_release(initial_compatible_, bitmask ? 0 : num_patterns * overlay_count);
+		frontier_.clear();
+		if (!frontier) size_or_release(frontier_, 0);
+		size_or_release(frontier_seen_, frontier ? num_cells_ : 0);
+
+		// Filled in by 'prepare_block_offsets' once the overlays are known.
+		block_offsets_.reserve(CellLayout::BLOCK * CellLayout::BLOCK * overlay_count);
+		block_overlays_.reserve(overlay_count);
+	}
+
+	bool Model::stacks_positions() const {
+		return settings.coalesce_bans || settings.propagation == Propagation::BITMASK;
+	}
+
+	Status Model::generate(std::vector<Pair> &overlays, std::vector<int> &counts, std::vector<std::vector<int>> &fit_table,
+			const Clock::time_point deadline, const CancellationToken* token) {
+		start(fit_table);
+		return resume(overlays, counts, fit_table, deadline, token);
+	}
+
+	void Model::start(std::vector<std::vector<int>> &fit_table) {
 		std::cout << "Called Generate" << std::endl;
 
 		// Initialize board into complete superposition, and pick a random wave to collapse
 		clear(fit_table);
-		Pair lowest_entropy_idx = Pair(rand_int(wave_shape.x), rand_int(wave_shape.y));
-		int iteration = 0;
-		while ((iteration_limit < 0 || iteration < iteration_limit) && lowest_entropy_idx.non_negative()) {
+		next_wave_ = Pair(rand_int(wave_shape.x), rand_int(wave_shape.y));
+		select_pending_ = false;
+		iteration_ = 0;
+	}
+
+	Status Model::resume(std::vector<Pair> &overlays, std::vector<int> &counts, std::vector<std::vector<int>> &fit_table,
+			const Clock::time_point deadline, const CancellationToken* token) {
+		prepare_block_offsets(overlays);
+		while (true) {
 			/* Standard wfc Loop:
 			 *		1. Observe a wave and collapse it's state
 			 *		2. Propagate the changes throughout the board and update superposition
@@ -36,20 +153,49 @@ namespace wfc
 			 *		3. After the board state has stabilized, find the position of
 			 *		   lowest entropy (most likely to be observed) for the next
 			 *		   observation.
+			 *
+			 * The loop is entered at step 2, so an interrupted propagation finishes
+			 * before anything else happens.
 			 */
-			observe_wave(lowest_entropy_idx, counts);
-			propagate(overlays, fit_table);
-			get_lowest_entropy(lowest_entropy_idx);
+			if (!propagate(overlays, fit_table, deadline, token))
+				return (token && token->cancelled()) ? Status::CANCELLED : Status::TIMED_OUT;
+			if (select_pending_) {
+				select_wave(next_wave_);
+				select_pending_ = false;
 
-			iteration += 1;
-			if (iteration % 1000 == 0)
-				std::cout << "iteration: " << iteration << std::endl;
+				// Never report a finished board while a position is still undecided. The
+				// cursor only moves forward, so this costs one pass over the board in total.
+				if (!next_wave_.non_negative() && !next_scanline(next_wave_))
+					next_wave_ = Pair(-1, -1);
+			}
+
+			if (!next_wave_.non_negative()) {
+				std::cout << "Finished Algorithm" << std::endl;
+				return contradictions_ > 0 ? Status::CONTRADICTION : Status::COMPLETE;
+			}
+			if (settings.stop_on_contradiction && contradictions_ > 0)
+				return Status::CONTRADICTION;
+			if (iteration_limit >= 0 && iteration_ >= iteration_limit)
+				return Status::ITERATION_LIMIT;
+			if (interrupted(deadline, token))
+				return (token && token->cancelled()) ? Status::CANCELLED : Status::TIMED_OUT;
+
+			observe_wave(next_wave_, counts);
+			select_pending_ = true;
+
+			iteration_ += 1;
+			if (iteration_ % 1000 == 0)
+				std::cout << "iteration: " << iteration_ << std::endl;
 		}
-		std::cout << "Finished Algorithm" << std::endl;
+	}
+
+	bool Model::interrupted(const Clock::time_point deadline, const CancellationToken* token) const {
+		if (token && token->cancelled()) return true;
+		return deadline != Clock::time_point::max() && Clock::now() >= deadline;
 	}
 
 	void Model::get_superposition(const int row, const int col, std::vector<int> &patt_idxs) {
-		const int idx_row_col_patt_base = row*wave_shape.x*num_patterns + col*num_patterns;
+		const int idx_row_col_patt_base = layout_.index(Pair(col, row)) * num_patterns;
 
 		// Determines the superposition of patterns at this position.
 		int num_valid_patterns = 0;
@@ -61,47 +207,242 @@ namespace wfc
 		}
 	}
 
+	void Model::get_observed(std::vector<int> &out) const {
+		out.resize(wave_shape.size);
+		for (int row = 0; row < wave_shape.y; row++) {
+			for (int col = 0; col < wave_shape.x; col++)
+				out[row*wave_shape.x + col] = observed_[layout_.index(Pair(col, row))];
+		}
+	}
+
 	void Model::clear(std::vector<std::vector<int>> &fit_table) {
-		for (int wave = 0; wave < wave_shape.size; wave++) {
+		size_workspace();
+
+		if (settings.propagation == Propagation::BITMASK) {
+			// Build the fit masks, and allow every pattern at every position.
+			std::fill(fit_masks_.begin(), fit_masks_.end(), 0);
+			for (int fit = 0; fit < num_patterns * overlay_count; fit++) {
+				for (int patt : fit_table[fit])
+					fit_masks_[fit*ban_words_ + patt/64] |= uint64_t(1) << (patt % 64);
+			}
+			for (int wave = 0; wave < num_cells_; wave++) {
+				uint64_t* mask = &wave_masks_[wave * ban_words_];
+				std::fill(mask, mask + ban_words_, ~uint64_t(0));
+				if (num_patterns % 64)
+					mask[ban_words_ - 1] = (uint64_t(1) << (num_patterns % 64)) - 1;
+			}
+		} else {
+			// Count of compatible neighbors in the fit table (to all states), which is
+			// the same for every position.
 			for (int patt = 0; patt < num_patterns; patt++) {
-				waves_[wave * num_patterns + patt] = true;
 				for (int overlay=0; overlay < overlay_count; overlay++) {
-					// Reset count of compatible neighbors in the fit table (to all states)
-					compatible_neighbors_[(wave*num_patterns + patt)*overlay_count + overlay] = fit_table[patt*overlay_count + (overlay + 2)%overlay_count].size();
+					initial_compatible_[patt*overlay_count + overlay] = fit_table[patt*overlay_count + (overlay + 2)%overlay_count].size();
 				}
 			}
-			observed_[wave] = -1;
-			entropy_[wave] = num_patterns;
+
+			const int compat_stride = num_patterns * overlay_count;
+			for (int wave = 0; wave < num_cells_; wave++) {
+				std::copy(initial_compatible_.begin(), initial_compatible_.end(),
+					compatible_neighbors_.begin() + wave*compat_stride);
+			}
 		}
+		std::fill(waves_.begin(), waves_.end(), true);
+		std::fill(observed_.begin(), observed_.end(), -1);
+		std::fill(entropy_.begin(), entropy_.end(), num_patterns);
+
+		// Padding positions outside of the board start (and stay) fully collapsed, so
+		// they are never observed or propagated into.
+		if (num_cells_ > wave_shape.size) {
+			for (int wave = 0; wave < num_cells_; wave++) {
+				if (!(layout_.position(wave) < wave_shape)) {
+					entropy_[wave] = 0;
+					std::fill(waves_.begin() + wave*num_patterns, waves_.begin() + (wave + 1)*num_patterns, false);
+				}
+			}
+		}
+		std::fill(pending_bans_.begin(), pending_bans_.end(), 0);
+		std::fill(queued_.begin(), queued_.end(), false);
+		std::fill(frontier_seen_.begin(), frontier_seen_.end(), false);
+		frontier_head_ = 0;
+		scan_cursor_ = 0;
+		contradictions_ = 0;
+		spiral_leg_ = 0;
+	}
+
+	int Model::count_contradictions() const {
+		return contradictions_;
+	}
+
+	void Model::select_wave(Pair &idx) {
+		bool found = false;
+		switch (settings.ordering) {
+			case Ordering::GLOBAL_ENTROPY:
+				get_lowest_entropy(idx);
+				return;
+			case Ordering::SCANLINE:
+				found = next_scanline(idx);
+				break;
+			case Ordering::SPIRAL:
+				found = next_spiral(idx);
+				break;
+			case Ordering::FRONTIER:
+				found = next_frontier(idx);
+				break;
+			case Ordering::LOCAL_ENTROPY:
+				found = get_lowest_local_entropy(idx);
+				break;
+		}
+		if (!found) idx = Pair(-1, -1);
 	}
 
 	void Model::get_lowest_entropy(Pair &idx) {
 		int r = -1; int c = -1;
 		int lowest_entropy = -1;
-		const int waves_count = wave_shape.size;
+		const int waves_count = num_cells_;
 
 		// Checks all non-collapsed positions to find the position of lowest entropy.
-		for (int wave_idx = 1; wave_idx < waves_count; wave_idx++) {
+		for (int wave_idx = 0; wave_idx < waves_count; wave_idx++) {
 			const int entropy_val = entropy_[wave_idx];
 			if ((lowest_entropy < 0 || entropy_val < lowest_entropy) && entropy_val > 0 && observed_[wave_idx] == -1) {
 				lowest_entropy = entropy_val;
-				r = wave_idx/wave_shape.x; c = wave_idx%wave_shape.x;
+				const Pair pos = layout_.position(wave_idx);
+				r = pos.y; c = pos.x;
+			}
+		}
+		idx.x = c; idx.y = r;
+	}
+
+	bool Model::get_lowest_local_entropy(Pair &idx) {
+		const Pair center = idx;
+		int lowest_entropy = -1;
+
+		// Checks the non-collapsed positions in the window around the last observation.
+		for (int dy = -settings.window; dy <= settings.window; dy++) {
+			for (int dx = -settings.window; dx <= settings.window; dx++) {
+				Pair pos = center + Pair(dx, dy);
+				if (!wrap(pos)) continue;
+
+				const int wave_idx = layout_.index(pos);
+				if (undecided(wave_idx) && (lowest_entropy < 0 || entropy_[wave_idx] < lowest_entropy)) {
+					lowest_entropy = entropy_[wave_idx];
+					idx = pos;
+				}
+			}
+		}
+
+		// The window is fully decided, so jump to the next undecided position.
+		return lowest_entropy >= 0 || next_scanline(idx);
+	}
+
+	bool Model::next_scanline(Pair &idx) {
+		// Positions never become undecided again, so the cursor only moves forward.
+		// The cursor walks storage order, which is row-major within each block for
+		// blocked layouts.
+		while (scan_cursor_ < num_cells_ && !undecided(scan_cursor_))
+			scan_cursor_++;
+		if (scan_cursor_ >= num_cells_) return false;
+
+		idx = layout_.position(scan_cursor_);
+		return true;
+	}
+
+	/**
+	 * \brief Steps of 'dir' (-1, 0 or 1) needed to move 'coord' into [0, size), or
+	 * INT32_MAX if it never gets there.
+	 */
+	static int steps_onto_board(const int coord, const int dir, const int size) {
+		if (coord >= 0 && coord < size) return 0;
+		if (dir > 0 && coord < 0) return -coord;
+		if (dir < 0 && coord >= size) return coord - size + 1;
+		return INT32_MAX;
+	}
+
+	bool Model::next_spiral(Pair &idx) {
+		static const int dx[4] = {1, 0, -1, 0};
+		static const int dy[4] = {0, 1, 0, -1};
+
+		// Start the spiral at the first observation.
+		if (spiral_leg_ == 0) {
+			spiral_pos_ = idx;
+			spiral_dir_ = 0;
+			spiral_leg_ = 1;
+			spiral_step_ = 0;
+		}
+
+		// Once a leg is longer than the board, the spiral has covered all of it.
+		const int max_leg = 2 * MAX(wave_shape.x, wave_shape.y) + 1;
+		while (spiral_leg_ <= max_leg) {
+			const int step_x = dx[spiral_dir_], step_y = dy[spiral_dir_];
+			int skip = MAX(steps_onto_board(spiral_pos_.x, step_x, wave_shape.x),
+				steps_onto_board(spiral_pos_.y, step_y, wave_shape.y));
+			if (skip == 0) {
+				if (undecided(layout_.index(spiral_pos_))) {
+					idx = spiral_pos_;
+					return true;
+				}
+				skip = 1;
+			}
+
+			// Off the board, jump straight to where the leg re-enters it, or to the
+			// next turn, so legs on a long, narrow board cost O(1) outside of it.
+			skip = MIN(skip, spiral_leg_ - spiral_step_);
+			spiral_pos_ = spiral_pos_ + Pair(step_x * skip, step_y * skip);
+			spiral_step_ += skip;
+			if (spiral_step_ == spiral_leg_) {
+				spiral_step_ = 0;
+				spiral_dir_ = (spiral_dir_ + 1) % 4;
+				if (spiral_dir_ % 2 == 0) spiral_leg_++;
+			}
+		}
+		return false;
+	}
+
+	bool Model::next_frontier(Pair &idx) {
+		static const Pair neighbors[4] = {Pair(-1, 0), Pair(0, 1), Pair(1, 0), Pair(0, -1)};
+
+		// Each position joins the frontier at most once.
+		for (const Pair& neighbor : neighbors) {
+			Pair pos = idx + neighbor;
+			if (!wrap(pos)) continue;
+
+			const int wave_idx = layout_.index(pos);
+			if (!frontier_seen_[wave_idx]) {
+				frontier_seen_[wave_idx] = true;
+				frontier_.push_back(wave_idx);
+			}
+		}
+
+		while (frontier_head_ < frontier_.size()) {
+			const int wave_idx = frontier_[frontier_head_];
+			if (undecided(wave_idx)) {
+				idx = layout_.position(wave_idx);
+				return true;
 			}
+			frontier_head_++;
 		}
-		idx.x = c;; idx.y = r;
+
+		// The observed region is closed off, so start a new one.
+		return next_scanline(idx);
+	}
+
+	bool Model::undecided(const int wave_i) const {
+		return observed_[wave_i] == -1 && entropy_[wave_i] > 0;
+	}
+
+	bool Model::wrap(Pair &pos) const {
+		if (periodic_) pos = pos % wave_shape;
+		return pos.non_negative() && pos < wave_shape;
 	}
 
 	void Model::observe_wave(Pair &pos, std::vector<int> &counts) {
-		const int idx_row_col_patt_base = get_idx(pos, wave_shape, num_patterns, 0);
+		const int wave_i = layout_.index(pos);
+		const int idx_row_col_patt_base = wave_i * num_patterns;
 
 		// Determines superposition of states and their total frequency counts.
 		int possible_patterns_sum = 0;
-		std::vector<int> possible_indices;
 		for (int i = 0; i < num_patterns; i++) {
-			if (waves_[idx_row_col_patt_base + i]) {
+			if (waves_[idx_row_col_patt_base + i])
 				possible_patterns_sum += counts[i];
-				possible_indices.push_back(i);
-			}
 		}
 
 		int rnd = rand_int(possible_patterns_sum)+1;
@@ -118,80 +459,194 @@ namespace wfc
 		// Bans all other states, since we have collapsed to a single state.
 		for (int patt_idx = 0; patt_idx < num_patterns; patt_idx++) {
 			if (waves_[patt_idx + idx_row_col_patt_base] != (patt_idx == collapsed_index)) 
-				ban_waveform(Waveform(pos, patt_idx));
+				ban_waveform(wave_i, patt_idx);
 		}
 
 		// Assigns the final state of this position.
-		observed_[get_idx(pos, wave_shape, 1, 0)] = collapsed_index;
+		observed_[wave_i] = collapsed_index;
 	}
 
-	void Model::propagate(std::vector<Pair>& overlays, std::vector<std::vector<int>> &fit_table) {
-		// int iterations = 0;
-		while (stack_index_ > 0) {
-			const Waveform wave_f = pop_waveform();
-			Pair wave = wave_f.pos;
-			const int pattern_i = wave_f.state;
+	bool Model::propagate(std::vector<Pair>& overlays, std::vector<std::vector<int>> &fit_table,
+			const Clock::time_point deadline, const CancellationToken* token) {
+		int steps = 0;
+		while (!propagate_stack_.empty()) {
+			if (++steps % INTERRUPT_CHECK_INTERVAL == 0 && interrupted(deadline, token))
+				return false;
+
+			const uint32_t entry = propagate_stack_.back();
+			propagate_stack_.pop_back();
 
-			// Check all overlayed tiles.
-			for(int overlay=0; overlay < overlay_count; overlay++) {
-				Pair wave_o;
+			if (!stacks_positions()) {
+				propagate_ban(entry / num_patterns, entry % num_patterns, overlays, fit_table);
+				continue;
+			}
+
+			const int wave_i = entry;
+			queued_[wave_i] = false;
+			if (settings.propagation == Propagation::BITMASK) {
+				propagate_mask(wave_i, overlays);
+				continue;
+			}
 
-				// If periodic, wrap positions past the edge of the board.
-				if (periodic_) {
-					wave_o = (wave + overlays[overlay])%wave_shape;
-				} else {
-					wave_o = wave + overlays[overlay];
+			// Propagate every pattern banned here since this position was queued. The
+			// position may be re-queued while its bans propagate, so take each word
+			// of the mask before walking it.
+			uint64_t* pending = &pending_bans_[wave_i * ban_words_];
+			for (int word = 0; word < ban_words_; word++) {
+				uint64_t bits = pending[word];
+				pending[word] = 0;
+				while (bits) {
+					const int pattern_i = word*64 + __builtin_ctzll(bits);
+					bits &= bits - 1;
+					propagate_ban(wave_i, pattern_i, overlays, fit_table);
 				}
+			}
+		}
+		return true;
+	}
+
+	void Model::prepare_block_offsets(std::vector<Pair>& overlays) {
+		const int block = CellLayout::BLOCK;
+		bool current = block_layout_ == settings.layout && block_overlays_.size() == overlays.size();
+		for (size_t i = 0; current && i < overlays.size(); i++)
+			current = block_overlays_[i].x == overlays[i].x && block_overlays_[i].y == overlays[i].y;
+		if (current) return;
 
-				const int wave_o_i = get_idx(wave_o, wave_shape, num_patterns, 0);
-				const int wave_o_i_base = get_idx(wave_o, wave_shape, 1, 0);
-
-				// If position is valid and non-collapsed, then propagate changes through
-				// this position (wave_o).
-				if (wave_o.non_negative() && wave_o < wave_shape && entropy_[wave_o_i_base] > 1 ) {
-					auto valid_patterns = fit_table[pattern_i * overlay_count + overlay];
-					for (int pattern_2: valid_patterns)	{
-						if(waves_[wave_o_i + pattern_2]) {
-							// Get opposite overlay
-							const int compat_idx = (wave_o_i + pattern_2)*overlay_count + overlay;
-							compatible_neighbors_[compat_idx]--;
-
-							// If there are no valid neighbors left, this state is impossible.
-							if (compatible_neighbors_[compat_idx] == 0) 
-								ban_waveform(Waveform(wave_o, pattern_2));
-						}
+		// Storage offsets between positions in the same block are the same for every
+		// block, so they are computed once from the first one.
+		block_layout_ = settings.layout;
+		block_overlays_.assign(overlays.begin(), overlays.end());
+		block_offsets_.resize(block * block * overlays.size());
+		const CellLayout sample(settings.layout == Layout::ROW_MAJOR ? Layout::TILED : settings.layout, Pair(block, block));
+		for (int y = 0; y < block; y++) {
+			for (int x = 0; x < block; x++) {
+				const Pair pos = Pair(x, y);
+				for (size_t overlay = 0; overlay < overlays.size(); overlay++) {
+					const Pair pos_o = pos + overlays[overlay];
+					int& offset = block_offsets_[sample.block_local(pos) * overlays.size() + overlay];
+					offset = (pos_o.non_negative() && pos_o.shifted_less_than(Pair(block, block), 0)) ?
+						sample.index(pos_o) - sample.index(pos) : NO_BLOCK_OFFSET;
+				}
+			}
+		}
+	}
+
+	void Model::propagate_ban(const int wave_i, const int pattern_i, std::vector<Pair>& overlays,
+			std::vector<std::vector<int>> &fit_table) {
+		const Pair wave = layout_.position(wave_i);
+		const int* block_offsets = block_offsets_for(wave);
+
+		// Check all overlayed tiles.
+		for(int overlay=0; overlay < overlay_count; overlay++) {
+			const int wave_o_i_base = neighbor_index(wave_i, wave, overlay, overlays, block_offsets);
+			const int wave_o_i = wave_o_i_base * num_patterns;
+
+			// If position is valid and non-collapsed, then propagate changes through
+			// this position (wave_o).
+			if (wave_o_i_base >= 0 && entropy_[wave_o_i_base] > 1 ) {
+				const auto &valid_patterns = fit_table[pattern_i * overlay_count + overlay];
+				for (int pattern_2: valid_patterns)	{
+					if(waves_[wave_o_i + pattern_2]) {
+						// Get opposite overlay
+						const int compat_idx = (wave_o_i + pattern_2)*overlay_count + overlay;
+						compatible_neighbors_[compat_idx]--;
+
+						// If there are no valid neighbors left, this state is impossible.
+						if (compatible_neighbors_[compat_idx] == 0) 
+							ban_waveform(wave_o_i_base, pattern_2);
 					}
 				}
 			}
+		}
+	}
+
+	void Model::propagate_mask(const int wave_i, std::vector<Pair>& overlays) {
+		const Pair wave = layout_.position(wave_i);
+		const int* block_offsets = block_offsets_for(wave);
+		const uint64_t* allowed = &wave_masks_[wave_i * ban_words_];
 
-			// iterations += 1;
-			// if (iterations % 1000 == 0)
-			// 	std::cout << "propagation iteration: " << iterations << ", propagation stack size: " << stack_index_ << std::endl;
+		// A contradiction supports nothing, so propagating from it would empty every
+		// position it can reach. Leave it isolated instead.
+		if (entropy_[wave_i] == 0) return;
+
+		// Check all overlayed tiles.
+		for(int overlay=0; overlay < overlay_count; overlay++) {
+			const int wave_o_i_base = neighbor_index(wave_i, wave, overlay, overlays, block_offsets);
+			if (wave_o_i_base < 0 || entropy_[wave_o_i_base] <= 1)
+				continue;
+
+			// Union of the patterns that fit next to any pattern left at this position.
+			std::fill(support_.begin(), support_.end(), 0);
+			for (int word = 0; word < ban_words_; word++) {
+				uint64_t bits = allowed[word];
+				while (bits) {
+					const int pattern_i = word*64 + __builtin_ctzll(bits);
+					bits &= bits - 1;
+					const uint64_t* fit = &fit_masks_[(pattern_i*overlay_count + overlay) * ban_words_];
+					for (int w = 0; w < ban_words_; w++)
+						support_[w] |= fit[w];
+				}
+			}
+
+			// Ban every pattern at wave_o that has lost all of it's support.
+			const uint64_t* allowed_o = &wave_masks_[wave_o_i_base * ban_words_];
+			for (int word = 0; word < ban_words_; word++) {
+				uint64_t bits = allowed_o[word] & ~support_[word];
+				while (bits) {
+					const int pattern_2 = word*64 + __builtin_ctzll(bits);
+					bits &= bits - 1;
+					ban_waveform(wave_o_i_base, pattern_2);
+				}
+			}
 		}
 	}
 
-	void Model::stack_waveform(Waveform& wave) {
-		propagate_stack_[stack_index_] = wave;
-		stack_index_+=1;
+	inline const int* Model::block_offsets_for(const Pair &wave) const {
+		if (!layout_.in_full_block(wave) || block_offsets_.empty()) return nullptr;
+		return &block_offsets_[layout_.block_local(wave) * overlay_count];
 	}
 
-	Waveform Model::pop_waveform() {
-		stack_index_-=1;
-		return propagate_stack_[stack_index_];
+	inline int Model::neighbor_index(const int wave_i, const Pair &wave, const int overlay,
+			std::vector<Pair>& overlays, const int* block_offsets) const {
+		if (block_offsets && block_offsets[overlay] != NO_BLOCK_OFFSET)
+			return wave_i + block_offsets[overlay];
+
+		// If periodic, wrap positions past the edge of the board.
+		Pair wave_o = wave + overlays[overlay];
+		return wrap(wave_o) ? layout_.index(wave_o) : -1;
 	}
 
-	void Model::ban_waveform(Waveform wave) {
-		const int waves_idx = get_idx(wave.pos, wave_shape, num_patterns, wave.state);
-		const int wave_i = get_idx(wave.pos, wave_shape, 1, 0);
+	void Model::stack_waveform(const int wave_i, const int pattern_i) {
+		if (!stacks_positions()) {
+			propagate_stack_.push_back(wave_i * num_patterns + pattern_i);
+			return;
+		}
 
-		// Mark this specific Waveform as disallowed, and update neighboring patterns
+		// Record the ban, and only queue the position if it isn't already waiting.
+		if (settings.propagation == Propagation::ADJACENCY)
+			pending_bans_[wave_i * ban_words_ + pattern_i / 64] |= uint64_t(1) << (pattern_i % 64);
+		if (!queued_[wave_i]) {
+			queued_[wave_i] = true;
+			propagate_stack_.push_back(wave_i);
+		}
+	}
+
+	void Model::ban_waveform(const int wave_i, const int pattern_i) {
+		const int waves_idx = wave_i * num_patterns + pattern_i;
+
+		// Mark this specific state as disallowed, and update neighboring patterns
 		// to block propagation through this state.
 		waves_[waves_idx] = false;
-		for (int overlay=0; overlay < overlay_count; overlay++) {
-			compatible_neighbors_[waves_idx*overlay_count + overlay] = 0;
+		if (settings.propagation == Propagation::BITMASK) {
+			wave_masks_[wave_i * ban_words_ + pattern_i / 64] &= ~(uint64_t(1) << (pattern_i % 64));
+		} else {
+			for (int overlay=0; overlay < overlay_count; overlay++) {
+				compatible_neighbors_[waves_idx*overlay_count + overlay] = 0;
+			}
 		}
-		stack_waveform(wave);	// Propagate changes through neighboring positions.
+		stack_waveform(wave_i, pattern_i);	// Propagate changes through neighboring positions.
 
 		entropy_[wave_i] -= 1;
+		if (entropy_[wave_i] == 0) contradictions_ += 1;
 	}
 }
@@ -1,6 +1,11 @@
 #pragma once
+#include <atomic>
+#include <chrono>
+#include <cstdint>
 #include <vector>
+#include "layout.h"
 #include "wfc_util.h"
+#include "workspace.h"
 
 /* Dimension legend
 	Template counts: T
@@ -9,73 +14,364 @@
 	Overlay counts: O
 	Wave shape x: WX
 	Wave shape y: WY
+
+	Shapes listed as [WX, WY, ...] are stored in the order given by the model's
+	cell layout (see 'Layout'), which may pad the board.
 */
 namespace wfc
 {
+	/**
+	 * \brief Internal representation used to propagate bans.
+	 */
+	enum class Propagation {
+		/**
+		 * \brief Walk the fit table's adjacency lists and keep a count of compatible
+		 * neighbors per state. Suits many patterns with sparse fit tables.
+		 */
+		ADJACENCY,
+
+		/**
+		 * \brief Keep each position's superposition as a bitmask and intersect it
+		 * with the union of its neighbor's fit masks. Suits few patterns with dense
+		 * fit tables, and needs no compatible neighbor counts.
+		 */
+		BITMASK
+	};
+
+	/**
+	 * \brief Strategy used to pick the next position to observe. All but the
+	 * global strategy select in O(1) amortized time, and keep consecutive
+	 * observations close together in memory.
+	 */
+	enum class Ordering {
+		/**
+		 * \brief The position of lowest entropy on the whole board.
+		 */
+		GLOBAL_ENTROPY,
+
+		/**
+		 * \brief The first undecided position in storage order: row-major, or
+		 * block by block for blocked layouts.
+		 */
+		SCANLINE,
+
+		/**
+		 * \brief Undecided positions in a spiral around the first observation.
+		 */
+		SPIRAL,
+
+		/**
+		 * \brief Undecided positions bordering the observed region, in the order
+		 * they were reached.
+		 */
+		FRONTIER,
+
+		/**
+		 * \brief The position of lowest entropy within 'window' positions of the
+		 * last observation. Falls back to scanline order if the window is decided.
+		 */
+		LOCAL_ENTROPY
+	};
+
+	typedef std::chrono::steady_clock Clock;
+
+	/**
+	 * \brief Outcome of a (possibly partial) generation.
+	 */
+	enum class Status {
+		/**
+		 * \brief Every position has been observed (see 'get_observed') without
+		 * contradictions.
+		 */
+		COMPLETE,
+
+		/**
+		 * \brief Some position was left with no valid pattern. Generation stops at
+		 * the first contradiction if 'stop_on_contradiction' is set, and otherwise
+		 * runs to the end.
+		 */
+		CONTRADICTION,
+
+		/**
+		 * \brief The deadline passed first. Call 'resume' to continue.
+		 */
+		TIMED_OUT,
+
+		/**
+		 * \brief The cancellation token was set first. Call 'resume' to continue.
+		 */
+		CANCELLED,
+
+		/**
+		 * \brief The model's iteration limit was reached.
+		 */
+		ITERATION_LIMIT
+	};
+
+	/**
+	 * \brief Flag used to ask a generation running on another thread to pause.
+	 */
+	class CancellationToken {
+	public:
+		void cancel() { cancelled_.store(true, std::memory_order_relaxed); }
+		void reset() { cancelled_.store(false, std::memory_order_relaxed); }
+		bool cancelled() const { return cancelled_.load(std::memory_order_relaxed); }
+
+	private:
+		std::atomic<bool> cancelled_{false};
+	};
+
+	/**
+	 * \brief Tunable behaviour of a Model that does not change its results' validity.
+	 */
+	struct ModelSettings {
+		/**
+		 * \brief Queue each position at most once, with a mask of its newly banned
+		 * patterns, instead of one propagation entry per ban. Bitmask propagation
+		 * always works per position.
+		 */
+		bool coalesce_bans;
+
+		Propagation propagation;
+		Ordering ordering;
+
+		/**
+		 * \brief Radius of the window searched by 'Ordering::LOCAL_ENTROPY'.
+		 */
+		int window;
+
+		/**
+		 * \brief Stop generating as soon as a position has no valid pattern left,
+		 * instead of finishing the rest of the board.
+		 */
+		bool stop_on_contradiction;
+
+		/**
+		 * \brief Order in which positions are stored. Blocked layouts keep vertical
+		 * neighbors close in memory, which helps on wide boards.
+		 */
+		Layout layout;
+
+	public:
+		ModelSettings(bool coalesce_bans=false, Propagation propagation=Propagation::ADJACENCY,
+			Ordering ordering=Ordering::GLOBAL_ENTROPY, int window=4, bool stop_on_contradiction=false,
+			Layout layout=Layout::ROW_MAJOR);
+	};
+
 	class Model {
 
 	public:
-		const char dim;
+		char dim;
 		const int iteration_limit;
-		const int num_patterns;
-		const int overlay_count;
+		int num_patterns;
+		int overlay_count;
 		Pair wave_shape;
 		Pair num_patt_2d;
+		ModelSettings settings;
 
 	private:
-		int stack_index_ = 0;
 		bool periodic_;
 
 		/**
-		 * \brief Fixed-space workspace stack for propagation step.
+		 * \brief Maps positions to storage indices. 'num_cells_' is the number of
+		 * stored positions, including padding.
+		 */
+		CellLayout layout_;
+		int num_cells_ = 0;
+
+		/**
+		 * \brief Storage offset from a position to each of its overlay neighbors,
+		 * for neighbors inside the same block. Computed for the overlays and
+		 * layout it was built with.
+		 *
+		 * Shape: [BLOCK * BLOCK, O]
+		 */
+		workspace_vector<int> block_offsets_;
+		workspace_vector<Pair> block_overlays_;
+		Layout block_layout_ = Layout::ROW_MAJOR;
+
+		/**
+		 * \brief Progress of the current generation, kept so that it can be resumed.
+		 * 'next_wave_' is the next position to observe, or the last observed one
+		 * if 'select_pending_' is set.
+		 */
+		Pair next_wave_;
+		bool select_pending_ = false;
+		int iteration_ = 0;
+		int contradictions_ = 0;
+
+		/**
+		 * \brief Number of 64-bit words per position in 'pending_bans_'.
+		 */
+		int ban_words_ = 0;
+
+		/**
+		 * \brief Growable workspace stack for propagation step. Each entry is a packed
+		 * waves index (position * N + pattern), or just the position index when
+		 * bans are coalesced.
+		 *
+		 * Shape: [*] (at most WX * WY * N)
+		 */
+		workspace_vector<uint32_t> propagate_stack_;
+
+		/**
+		 * \brief Bitmask of patterns banned at a position since it was last
+		 * propagated. Only used when bans are coalesced.
+		 *
+		 * Shape: [WX, WY, ceil(N / 64)]
+		 */
+		workspace_vector<uint64_t> pending_bans_;
+
+		/**
+		 * \brief Stores whether a position is currently on the propagation stack.
+		 * Only used when bans are coalesced.
+		 *
+		 * Shape: [WX, WY]
+		 */
+		workspace_vector<char> queued_;
+
+		/**
+		 * \brief Bitmask of the patterns still allowed at a position. Only used by
+		 * bitmask propagation.
+		 *
+		 * Shape: [WX, WY, ceil(N / 64)]
+		 */
+		workspace_vector<uint64_t> wave_masks_;
+
+		/**
+		 * \brief Bitmask form of the fit table. Only used by bitmask propagation.
+		 *
+		 * Shape: [N, O, ceil(N / 64)]
+		 */
+		workspace_vector<uint64_t> fit_masks_;
+
+		/**
+		 * \brief Scratch mask of the patterns supported by a neighbor.
 		 *
-		 * Shape: [WX * WY * N]
+		 * Shape: [ceil(N / 64)]
+		 */
+		workspace_vector<uint64_t> support_;
+
+		/**
+		 * \brief Next position to check for scanline ordering. Every position before
+		 * it has been decided.
 		 */
-		std::vector<Waveform> propagate_stack_;
+		int scan_cursor_ = 0;
+
+		/**
+		 * \brief Current point, direction, leg length and steps into the leg of the
+		 * spiral walked by spiral ordering. A leg length of 0 means the spiral has
+		 * not started.
+		 */
+		Pair spiral_pos_;
+		int spiral_dir_ = 0;
+		int spiral_leg_ = 0;
+		int spiral_step_ = 0;
+
+		/**
+		 * \brief FIFO of positions bordering the observed region, read from
+		 * 'frontier_head_'. Only used by frontier ordering.
+		 *
+		 * Shape: [*] (at most WX * WY)
+		 */
+		workspace_vector<uint32_t> frontier_;
+		size_t frontier_head_ = 0;
+
+		/**
+		 * \brief Stores whether a position has been added to the frontier. Only used
+		 * by frontier ordering.
+		 *
+		 * Shape: [WX, WY]
+		 */
+		workspace_vector<char> frontier_seen_;
 
 		/**
 		 * \brief Stores the entropy (number of valid patterns) for a given position.
 		 *
 		 * Shape: [WX, WY]
 		 */
-		std::vector<int> entropy_;
+		workspace_vector<int> entropy_;
 
 		/**
-		 * \brief Stores whether a specific Waveform (position, state) is allowed
+		 * \brief Stores whether a specific state (position, pattern) is allowed
 		 * (true/false).
 		 *
 		 * Shape: [WX, WY, N]
 		 */
-		std::vector<char> waves_;
+		workspace_vector<char> waves_;
 
 		/**
 		 * \brief Stores the index of the final collapsed pattern for a given position.
 		 *
 		 * Shape: [WX, WY]
 		 */
-		std::vector<int> observed_;
+		workspace_vector<int> observed_;
 
 		/**
 		 * \brief Stores a count of the number of compatible neighbors for this pattern.
 		 * If there are no compatible neighbors, then it is impossible for this pattern
-		 * to occur and we should ban it.
+		 * to occur and we should ban it. Only used by adjacency propagation.
 		 *
 		 * Shape: [WX, WY, N, O]
 		 */
-		std::vector<int> compatible_neighbors_;
+		workspace_vector<int> compatible_neighbors_;
+
+		/**
+		 * \brief The compatible neighbor counts of a fully superposed wave, copied
+		 * into every position on 'clear'.
+		 *
+		 * Shape: [N, O]
+		 */
+		workspace_vector<int> initial_compatible_;
 
 	public:
 		/**
-		 * \brief Initializes a model instance and allocates all workspace data.
+		 * \brief Initializes a model instance and allocates the workspace data needed
+		 * by the given settings.
 		 */
 		Model(Pair &output_shape, const int num_patterns, const int overlay_count, 
-			const char dim, const bool periodic=false, const int iteration_limit=-1);
+			const char dim, const bool periodic=false, const ModelSettings &settings=ModelSettings(),
+			const int iteration_limit=-1, const WorkspaceOptions &options=WorkspaceOptions());
+
+		/**
+		 * \brief Rebinds the model to a new rule set and output shape. Workspace
+		 * buffers keep their capacity, so this only allocates when the new shape
+		 * needs more room than any previous one.
+		 */
+		void resize(Pair &output_shape, const int num_patterns, const int overlay_count,
+			const char dim);
+
+		/**
+		 * \brief Grows workspace capacity to fit the given shape without changing the
+		 * current binding. Reserving for the largest expected shape up front means
+		 * later calls to 'resize' and 'generate' never allocate.
+		 */
+		void reserve(Pair &output_shape, const int num_patterns, const int overlay_count,
+			const char dim);
 		
 		/**
 		 * \brief Runs the wfc algorithm and stores the output image (call 'get_image'
 		 * to access).
 		 */
-		void generate(std::vector<Pair> &overlays, std::vector<int> &counts, std::vector<std::vector<int>> &fit_table);
+		Status generate(std::vector<Pair> &overlays, std::vector<int> &counts, std::vector<std::vector<int>> &fit_table,
+			const Clock::time_point deadline=Clock::time_point::max(), const CancellationToken* token=nullptr);
+
+		/**
+		 * \brief Resets the board and picks the first wave to observe, without
+		 * running any iterations. Call 'resume' to run them.
+		 */
+		void start(std::vector<std::vector<int>> &fit_table);
+
+		/**
+		 * \brief Continues the current generation until it finishes, the deadline
+		 * passes or the token is cancelled. The deadline and token are checked
+		 * between observations and periodically during propagation; an interrupted
+		 * propagation picks up where it left off on the next call. The partially
+		 * collapsed board can be read at any point (see 'get_superposition' and
+		 * 'get_observed').
+		 */
+		Status resume(std::vector<Pair> &overlays, std::vector<int> &counts, std::vector<std::vector<int>> &fit_table,
+			const Clock::time_point deadline=Clock::time_point::max(), const CancellationToken* token=nullptr);
 		
 		/**
 		 * \brief Generates an image of the superpositions of the wave at (row, col),
@@ -84,15 +380,68 @@ namespace wfc
 		void get_superposition(int row, int col, std::vector<int> &patt_idxs);
 		
 		/**
-		 * \brief Resets all tiles to a perfect superposition.
+		 * \brief Stores the collapsed pattern index of every position in 'out', in
+		 * row-major order. Positions that were never collapsed are -1.
+		 *
+		 * Shape: [WY, WX]
+		 */
+		void get_observed(std::vector<int> &out) const;
+
+		/**
+		 * \return The number of positions left with no valid pattern.
+		 */
+		int count_contradictions() const;
+
+		/**
+		 * \brief Resets all tiles to a perfect superposition. Does not allocate once
+		 * the workspace has been sized for the current settings.
 		 */
 		void clear(std::vector<std::vector<int>> &fit_table);
 		
 	private:
+		/**
+		 * \brief Picks the next wave to observe with the configured ordering, given
+		 * the last observed position in idx. Stores it's position in idx, or
+		 * (-1, -1) if every position has been decided.
+		 */
+		void select_wave(Pair &idx);
+
 		/**
 		 * \brief Finds the wave with lowest entropy and stores it's position in idx
 		 */
 		void get_lowest_entropy(Pair &idx);
+
+		/**
+		 * \brief Finds the wave with lowest entropy within the window around idx.
+		 */
+		bool get_lowest_local_entropy(Pair &idx);
+
+		/**
+		 * \brief Finds the next undecided wave in row-major order.
+		 */
+		bool next_scanline(Pair &idx);
+
+		/**
+		 * \brief Finds the next undecided wave along the spiral around idx.
+		 */
+		bool next_spiral(Pair &idx);
+
+		/**
+		 * \brief Adds the neighbors of idx to the frontier, and finds the oldest
+		 * undecided wave on it.
+		 */
+		bool next_frontier(Pair &idx);
+
+		/**
+		 * \return True if the wave can still be observed.
+		 */
+		bool undecided(const int wave_i) const;
+
+		/**
+		 * \brief Moves the position into the board if periodic. Returns false if it
+		 * lies outside of the board.
+		 */
+		bool wrap(Pair &pos) const;
 		
 		/**
 		 * \brief Performs an observation on the wave at the given position and
@@ -102,25 +451,71 @@ namespace wfc
 		
 		/**
 		 * \brief Iteratively collapses waves in the tilemap until no conflicts exist.
-		 * Meant to be used after collapsing a wave by observing it.
+		 * Meant to be used after collapsing a wave by observing it. Returns false
+		 * if interrupted before the stack was emptied.
 		 */
-		void propagate(std::vector<Pair>& overlays, std::vector<std::vector<int>> &fit_table);
+		bool propagate(std::vector<Pair>& overlays, std::vector<std::vector<int>> &fit_table,
+			const Clock::time_point deadline, const CancellationToken* token);
 
 		/**
-		 * \brief Adds a wave to the propagation stack to propagate changes to it's
-		 * neighbors (determined by overlays).
+		 * \return True if the deadline has passed or the token is cancelled.
 		 */
-		void stack_waveform(Waveform& wave);
-		
+		bool interrupted(const Clock::time_point deadline, const CancellationToken* token) const;
+
+		/**
+		 * \brief Propagates the removal of a single pattern at the given position to
+		 * it's neighbors (determined by overlays).
+		 */
+		void propagate_ban(const int wave_i, const int pattern_i, std::vector<Pair>& overlays,
+			std::vector<std::vector<int>> &fit_table);
+
 		/**
-		 * \return The last Waveform added to the propagation stack.
+		 * \brief Removes every pattern from the neighbors of the given position that
+		 * is no longer supported by any pattern left at it. Used by bitmask
+		 * propagation.
 		 */
-		Waveform pop_waveform();
+		void propagate_mask(const int wave_i, std::vector<Pair>& overlays);
 
 		/**
-		 * \brief Bans a specific state at the Waveform position. Partially collapses
+		 * \return True if the propagation stack holds positions rather than
+		 * individual bans.
+		 */
+		bool stacks_positions() const;
+
+		/**
+		 * \brief Adds a banned state to the propagation stack to propagate changes to
+		 * it's neighbors (determined by overlays).
+		 */
+		void stack_waveform(const int wave_i, const int pattern_i);
+
+		/**
+		 * \brief Bans a specific state at the given position. Partially collapses
 		 * the overall state at that position and reduces it's entropy.
 		 */
-		void ban_waveform(Waveform wave);
+		void ban_waveform(const int wave_i, const int pattern_i);
+
+		/**
+		 * \brief Sizes all buffers for the current shape and settings.
+		 */
+		void size_workspace();
+
+		/**
+		 * \brief Computes 'block_offsets_' for the given overlays, if they or the
+		 * layout changed since it was last computed.
+		 */
+		void prepare_block_offsets(std::vector<Pair>& overlays);
+
+		/**
+		 * \return The block neighbor offsets of the given position, or nullptr if its
+		 * block is not entirely inside of the board.
+		 */
+		inline const int* block_offsets_for(const Pair &wave) const;
+
+		/**
+		 * \return The storage index of the overlay neighbor of the given position, or
+		 * -1 if it lies outside of a non-periodic board.
+		 */
+		inline int neighbor_index(const int wave_i, const Pair &wave, const int overlay,
+			std::vector<Pair>& overlays, const int* block_offsets) const;
 	};
 }
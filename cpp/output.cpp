@@ -2,7 +2,7 @@
 
 namespace wfc
 {
-	void render_image(Model& model, std::vector<cv::Mat>& patterns, cv::Mat &out_img) {
+	void render_image(Model& model, const PatternSet& patterns, cv::Mat &out_img) {
 		const int height = model.wave_shape.y;
 		const int width = model.wave_shape.x;
 		const int dim = model.dim;
@@ -24,7 +24,7 @@ namespace wfc
 						} else {
 							bgr = BGR(0, 0, 0);
 							for (int patt_idx: valid_patts)
-								bgr += patterns[patt_idx].ptr<BGR>(r - row)[c - col] / valid_patts.size();
+								bgr += patterns.color(patt_idx, r - row, c - col) / valid_patts.size();
 						}
 					}
 				}
@@ -33,4 +33,24 @@ namespace wfc
 
 		std::cout << "Finished Rendering" << std::endl;
 	}
+
+	void render_grid(const std::vector<int>& grid, Pair& shape, const char dim,
+		const PatternSet& patterns, cv::Mat& out_img) {
+		for (int row=0; row < shape.y; row++) {
+			for (int col=0; col < shape.x; col++) {
+				const int patt_idx = grid[row*shape.x + col];
+				for (int r = row; r < row + dim; r++) {
+					for (int c = col; c < col + dim; c++) {
+						BGR& bgr = out_img.ptr<BGR>(r)[c];
+						if (patt_idx < 0) {
+							// Error: Position never collapsed (magenta).
+							bgr = BGR(204, 51, 255);
+						} else {
+							bgr = patterns.color(patt_idx, r - row, c - col);
+						}
+					}
+				}
+			}
+		}
+	}
 }
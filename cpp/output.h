@@ -1,5 +1,6 @@
 #pragma once
 #include "model.h"
+#include "pattern_set.h"
 
 namespace wfc
 {
@@ -7,5 +8,12 @@ namespace wfc
 	 * \brief Renders the board state of the given model into an output image. Patterns
 	 * must be ordered the same way as it's counts are passed into the model.
 	 */
-	void render_image(Model& model, std::vector<cv::Mat>& patterns, cv::Mat& out_img);
+	void render_image(Model& model, const PatternSet& patterns, cv::Mat& out_img);
+
+	/**
+	 * \brief Renders a row-major grid of collapsed pattern indices (see
+	 * 'Model::get_observed' and 'read_grid') into an output image.
+	 */
+	void render_grid(const std::vector<int>& grid, Pair& shape, const char dim,
+		const PatternSet& patterns, cv::Mat& out_img);
 }
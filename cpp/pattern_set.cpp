@@ -0,0 +1,102 @@
+#include "pattern_set.h"
+#include <cstring>
+
+namespace wfc
+{
+	PatternSet::PatternSet(char dim) : dim(dim), index_bytes(1) {}
+
+	void PatternSet::add(const uint8_t* pattern) {
+		pixels.insert(pixels.end(), pattern, pattern + pattern_bytes());
+		if (!packed()) return;
+
+		const int row_bytes = dim * index_bytes;
+		for (int row = 0; row < dim; row++) {
+			uint64_t word = 0;
+			for (int b = 0; b < row_bytes; b++)
+				word |= static_cast<uint64_t>(pattern[row * row_bytes + b]) << (8 * b);
+			rows.push_back(word);
+		}
+	}
+
+	void PatternSet::widen() {
+		if (index_bytes == 2) return;
+
+		std::vector<uint8_t> narrow;
+		narrow.swap(pixels);
+		rows.clear();
+		index_bytes = 2;
+
+		const size_t narrow_bytes = dim * dim;
+		std::vector<uint8_t> wide(pattern_bytes());
+		for (size_t start = 0; start < narrow.size(); start += narrow_bytes) {
+			for (size_t i = 0; i < narrow_bytes; i++)
+				set_index(wide.data(), i, narrow[start + i]);
+			add(wide.data());
+		}
+	}
+
+	void PatternSet::clear(char dim) {
+		this->dim = dim;
+		index_bytes = 1;
+		palette.clear();
+		pixels.clear();
+		rows.clear();
+	}
+
+	cv::Mat PatternSet::to_mat(const int pattern_i) const {
+		cv::Mat out(dim, dim, CV_8UC3);
+		for (int row = 0; row < dim; row++) {
+			for (int col = 0; col < dim; col++)
+				out.ptr<BGR>(row)[col] = color(pattern_i, row, col);
+		}
+		return out;
+	}
+
+	static uint32_t color_key(const BGR &color) {
+		return color.b | (color.g << 8) | (color.r << 16);
+	}
+
+	void index_palette(const std::vector<BGR> &palette, PaletteLookup &lookup) {
+		lookup.clear();
+		for (size_t i = 0; i < palette.size(); i++)
+			lookup.emplace(color_key(palette[i]), i);
+	}
+
+	int palette_index(std::vector<BGR> &palette, PaletteLookup &lookup, const BGR &color) {
+		const uint32_t key = color_key(color);
+		auto found = lookup.find(key);
+		if (found != lookup.end()) return found->second;
+		if (palette.size() >= MAX_PALETTE_SIZE) return -1;
+
+		lookup.emplace(key, palette.size());
+		palette.push_back(color);
+		return palette.size() - 1;
+	}
+
+	bool quantize_image(const cv::Mat &image, std::vector<BGR> &palette, std::vector<uint16_t> &out) {
+		CV_Assert(image.depth() == CV_8U && image.channels() == 3);
+		out.resize(image.rows * image.cols);
+
+		PaletteLookup lookup;
+		index_palette(palette, lookup);
+
+		// Neighboring pixels are usually the same color, so remember the last one
+		// to skip most lookups.
+		uint32_t last_key = UINT32_MAX;
+		int last_index = 0;
+		for (int row = 0; row < image.rows; row++) {
+			const BGR* p = image.ptr<BGR>(row);
+			uint16_t* dst = &out[row * image.cols];
+			for (int col = 0; col < image.cols; col++) {
+				const uint32_t key = color_key(p[col]);
+				if (key != last_key) {
+					last_index = palette_index(palette, lookup, p[col]);
+					if (last_index < 0) return false;
+					last_key = key;
+				}
+				dst[col] = last_index;
+			}
+		}
+		return true;
+	}
+}
@@ -0,0 +1,163 @@
+#pragma once
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+#include <opencv2/opencv.hpp>
+#include "wfc_util.h"
+
+namespace wfc
+{
+	/**
+	 * \brief Patterns whose rows take at most this many bytes of palette indices
+	 * also keep each row packed into a 64-bit word.
+	 */
+	const int PACKED_ROW_BYTES = 8;
+
+	/**
+	 * \brief Largest number of colors that fit in single byte palette indices.
+	 * Pattern sets with more colors fall back to two byte indices.
+	 */
+	const int NARROW_PALETTE_SIZE = 256;
+
+	/**
+	 * \brief Largest number of colors a palette can hold.
+	 */
+	const int MAX_PALETTE_SIZE = 65536;
+
+	/**
+	 * \brief Maps colors to their palette index, to build a palette quickly.
+	 */
+	typedef std::unordered_map<uint32_t, int> PaletteLookup;
+
+	/**
+	 * \brief A set of (D x D) patterns stored as palette indices in one contiguous
+	 * buffer. Colors are only looked up in the palette when rendering. Indices
+	 * take one byte while the palette has at most NARROW_PALETTE_SIZE colors, and
+	 * two (little-endian) otherwise.
+	 */
+	struct PatternSet {
+		char dim;
+
+		/**
+		 * \brief Bytes per palette index, 1 or 2.
+		 */
+		int index_bytes;
+
+		/**
+		 * \brief Color of each palette index.
+		 *
+		 * Shape: [*] (at most MAX_PALETTE_SIZE)
+		 */
+		std::vector<BGR> palette;
+
+		/**
+		 * \brief Palette index of every pixel of every pattern, row-major.
+		 *
+		 * Shape: [N, D, D, index_bytes]
+		 */
+		std::vector<uint8_t> pixels;
+
+		/**
+		 * \brief Every row of 'pixels' packed into a word, with the first byte of
+		 * the row in the lowest byte. Only filled in if 'packed()'.
+		 *
+		 * Shape: [N, D]
+		 */
+		std::vector<uint64_t> rows;
+
+	public:
+		PatternSet(char dim=0);
+
+		/**
+		 * \return The number of bytes of a single pattern.
+		 */
+		size_t pattern_bytes() const { return dim * dim * index_bytes; }
+
+		/**
+		 * \return The number of patterns (N).
+		 */
+		size_t size() const { return dim ? pixels.size() / pattern_bytes() : 0; }
+
+		bool empty() const { return pixels.empty(); }
+
+		/**
+		 * \return True if every row is also stored packed in 'rows'.
+		 */
+		bool packed() const { return dim * index_bytes <= PACKED_ROW_BYTES; }
+
+		/**
+		 * \return The (D x D) palette indices of the given pattern.
+		 */
+		const uint8_t* pattern(const int pattern_i) const { return &pixels[pattern_i * pattern_bytes()]; }
+
+		/**
+		 * \return The packed rows of the given pattern. Only valid if 'packed()'.
+		 */
+		const uint64_t* packed_rows(const int pattern_i) const { return &rows[pattern_i * dim]; }
+
+		/**
+		 * \return The i'th palette index of a pattern stored with this set's index width.
+		 */
+		int index_at(const uint8_t* pattern, const int i) const {
+			return index_bytes == 1 ? pattern[i] : pattern[2*i] | (pattern[2*i + 1] << 8);
+		}
+
+		/**
+		 * \brief Stores the i'th palette index of a pattern with this set's index width.
+		 */
+		void set_index(uint8_t* pattern, const int i, const int value) const {
+			if (index_bytes == 1) {
+				pattern[i] = value;
+			} else {
+				pattern[2*i] = value & 0xff;
+				pattern[2*i + 1] = value >> 8;
+			}
+		}
+
+		/**
+		 * \return The color of the pixel at (row, col) of the given pattern.
+		 */
+		const BGR& color(const int pattern_i, const int row, const int col) const {
+			return palette[index_at(pattern(pattern_i), row * dim + col)];
+		}
+
+		/**
+		 * \brief Appends a copy of the given (D x D) palette indices as a new pattern.
+		 */
+		void add(const uint8_t* pattern);
+
+		/**
+		 * \brief Switches to two byte indices, converting every stored pattern.
+		 */
+		void widen();
+
+		/**
+		 * \brief Removes every pattern and color, and changes the pattern dim.
+		 */
+		void clear(char dim);
+
+		/**
+		 * \return The given pattern as a (D x D) BGR image.
+		 */
+		cv::Mat to_mat(const int pattern_i) const;
+	};
+
+	/**
+	 * \brief Stores the index of every palette color in 'lookup'.
+	 */
+	void index_palette(const std::vector<BGR> &palette, PaletteLookup &lookup);
+
+	/**
+	 * \return The index of the color in the palette, after adding it (and to
+	 * 'lookup') if needed, or -1 if the palette is full.
+	 */
+	int palette_index(std::vector<BGR> &palette, PaletteLookup &lookup, const BGR &color);
+
+	/**
+	 * \brief Maps every pixel of a BGR image to its index in the palette, adding
+	 * colors that are not in it yet.
+	 *
+	 * \return False if the palette would need more than MAX_PALETTE_SIZE colors.
+	 */
+	bool quantize_image(const cv::Mat &image, std::vector<BGR> &palette, std::vector<uint16_t> &out);
+}
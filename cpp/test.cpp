@@ -1,6 +1,7 @@
 #include "input.h"
 #include "wfc.h"
 #include <opencv2/opencv.hpp>
+#include <thread>
 
 using namespace wfc;
 
@@ -12,11 +13,13 @@ int main(int argc, char** argv) {
 	int width = 64;
 	int height = 64;
 	int render = 0;
+	int grid = 0;
+	int tune = 0;
 	char* out_name;
 
 	if (!(argc > 2)) {
 		std::cout << "Usage {arg_name (options) | default}:" << std::endl <<
-			"\twfc {image folder} {tile dim | 3} {rotate? (0/1) | 1} {periodic? (0/1) | 1} {width | 64} {height | 64} {render? (0/1) | 0}"
+			"\twfc {image folder} {tile dim | 3} {rotate? (0/1) | 1} {periodic? (0/1) | 1} {width | 64} {height | 64} {output name | result.png} {render? (0/1) | 0} {grid only? (0/1) | 0} {tune? (0/1) | 0}"
 			<< std::endl;
 		return -1;
 	}
@@ -39,21 +42,25 @@ int main(int argc, char** argv) {
 	}
 	if (argc > 8)
 		render = atoi(argv[8]); // render toggle
+	if (argc > 9)
+		grid = atoi(argv[9]); // store the pattern index grid instead of an image
+	if (argc > 10)
+		tune = atoi(argv[10]); // calibrate settings if none are stored yet
 
 	// The set of overlays describing how to compare two patterns. Stored
 	// as an (x,y) shift. Shape: [O]
 	std::vector<Pair> overlays;
 	generate_neighbor_overlay(overlays);
 
-	// The set of input images to use as templates. Shape: [T]
-	std::vector<cv::Mat> template_imgs;
-	load_tiles(tiles_dir, template_imgs);
-
-
-	// The set of patterns/tiles taken from the input templates. Shape: [N]
-	std::vector<cv::Mat> patterns;
+	// The set of patterns/tiles taken from the input templates, as indices into a
+	// shared palette. The templates are decoded in parallel and never all held in
+	// memory at once. Shape: [N]
+	PatternSet patterns;
 	std::vector<int> counts;
-	create_waveforms(template_imgs, tile_dim, rotate, patterns, counts);
+	if (!load_patterns(tiles_dir, tile_dim, rotate, std::thread::hardware_concurrency(), patterns, counts)) {
+		std::cout << "Templates use more than " << MAX_PALETTE_SIZE << " colors" << std::endl;
+		return -1;
+	}
 
 	// Stores the set of allowed patterns for a given center pattern and
 	// overlay. Stored like an adjacency list. Shape: [N, O][*]
@@ -61,9 +68,25 @@ int main(int argc, char** argv) {
 	generate_fit_table(patterns, overlays, tile_dim, fit_table);
 
 	Pair p = Pair(width, height);
+
+	// Use the settings stored next to the templates for this rule set and output
+	// size. Without any, calibrate them if asked to, or guess from the rule set.
+	const uint64_t rule_set_hash = hash_rule_set(patterns, counts, overlays, tile_dim);
+	const std::string tuning_file = std::string(tiles_dir) + "/tuning.txt";
+	const TuningKey tuning_key(rule_set_hash, p, periodic);
+	ModelSettings settings;
+	if (!load_tuning(tuning_file, tuning_key, settings)) {
+		if (tune) {
+			settings = tune_model(p, tile_dim, periodic, overlays, counts, fit_table);
+			save_tuning(tuning_file, tuning_key, settings);
+		} else {
+			settings = suggest_settings(compute_rule_set_stats(patterns.size(), fit_table, p));
+		}
+	}
+
 	Model model(p,
 	            patterns.size(), overlays.size(),
-	            tile_dim, periodic);
+	            tile_dim, periodic, settings);
 
 	// Shows all patterns
 	if (render) {
@@ -77,9 +100,9 @@ int main(int argc, char** argv) {
 
 		for (int pat_idx1 = 0; pat_idx1 < model.num_patterns; pat_idx1++) {
 			cv::Mat scaled1;
-			auto patt1 = patterns[pat_idx1];
+			auto patt1 = patterns.to_mat(pat_idx1);
 			cv::resize(patt1, scaled1, cv::Size(128, 128), 0.0, 0.0, cv::INTER_AREA);
-			std::cout << "Pattern: " << pat_idx1 << " | Pattern count: " << patterns[pat_idx1] << std::endl;
+			std::cout << "Pattern: " << pat_idx1 << " | Pattern count: " << counts[pat_idx1] << std::endl;
 
 			for (int overlay_idx = 0; overlay_idx < model.overlay_count; overlay_idx++) {
 				size_t index = pat_idx1 * model.overlay_count + overlay_idx;
@@ -94,7 +117,7 @@ int main(int argc, char** argv) {
 				bool break_part = false;
 
 				for (int pat_idx2 = 0; pat_idx2 < model.num_patterns; pat_idx2++) {
-					auto patt2 = patterns[pat_idx2];
+					auto patt2 = patterns.to_mat(pat_idx2);
 					cv::Mat scaled2;
 					cv::resize(patt2, scaled2, cv::Size(128, 128), 0.0, 0.0, cv::INTER_AREA);
 					cv::Mat comb;
@@ -103,9 +126,10 @@ int main(int argc, char** argv) {
 
 					std::cout << "    " << "Table: " << (std::find(valid_patterns.begin(), valid_patterns.end(),
 					                                               pat_idx2) != valid_patterns.end()) << " | Calc: "
-						<< overlay_fit(patt1, patt2, overlay, model.dim) << std::endl;
+						<< overlay_fit(patterns, pat_idx1, pat_idx2, overlay) << std::endl;
 
-					std::cout << "    " << patterns_equal(patt1, patt2) << ": " << "Patterns are equal" << std::endl;
+					std::cout << "    " << patterns_equal(patterns.pattern(pat_idx1), patterns.pattern(pat_idx2), patterns.pattern_bytes())
+						<< ": " << "Patterns are equal" << std::endl;
 
 					cv::imshow("comparison", comb);
 					int k = cv::waitKey(0);
@@ -129,8 +153,22 @@ int main(int argc, char** argv) {
 
 	model.generate(overlays, counts, fit_table);
 
+	// Store only the collapsed pattern indices, which can be re-rendered later
+	// with the same rule set.
+	if (grid) {
+		std::vector<int> observed;
+		model.get_observed(observed);
+		GridHeader header(rule_set_hash, model.wave_shape, model.num_patterns, model.dim);
+
+		std::ostringstream outputDir;
+		outputDir << "results/" << out_name << ".wfcg";
+		write_grid(outputDir.str(), header, observed);
+		std::cout << outputDir.str() << std::endl;
+		return 0;
+	}
+
 	// Initialize blank output image
-	cv::Mat result = cv::Mat(width, width, template_imgs[0].type());
+	cv::Mat result = cv::Mat(width, width, CV_8UC3);
 
 	render_image(model, patterns, result);
 
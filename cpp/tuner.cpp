@@ -0,0 +1,352 @@
+#include "tuner.h"
+#include <chrono>
+#include <cstdlib>
+#include <fstream>
+#include <sstream>
+
+namespace wfc
+{
+	// Boards larger than this are calibrated at this size instead.
+	static const int CALIBRATION_SIZE = 64;
+
+	// Layouts only differ in the stride between rows, so they are calibrated on
+	// rows as wide as the output, up to this width, with fewer rows.
+	static const int LAYOUT_CALIBRATION_WIDTH = 1024;
+
+	static const char* ORDERING_NAMES[ORDERING_COUNT] = {"global_entropy", "scanline", "spiral", "frontier", "local_entropy"};
+
+	static const char* LAYOUT_NAMES[LAYOUT_COUNT] = {"row_major", "tiled", "morton"};
+
+	const char* ordering_name(const Ordering ordering) {
+		return ORDERING_NAMES[static_cast<int>(ordering)];
+	}
+
+	const char* layout_name(const Layout layout) {
+		return LAYOUT_NAMES[static_cast<int>(layout)];
+	}
+
+	bool parse_ordering(const std::string &name, Ordering &ordering) {
+		for (int i = 0; i < ORDERING_COUNT; i++) {
+			if (name == ORDERING_NAMES[i]) {
+				ordering = static_cast<Ordering>(i);
+				return true;
+			}
+		}
+		return false;
+	}
+
+	bool parse_layout(const std::string &name, Layout &layout) {
+		for (int i = 0; i < LAYOUT_COUNT; i++) {
+			if (name == LAYOUT_NAMES[i]) {
+				layout = static_cast<Layout>(i);
+				return true;
+			}
+		}
+		return false;
+	}
+
+	static const char* propagation_name(const Propagation propagation) {
+		return propagation == Propagation::BITMASK ? "bitmask" : "adjacency";
+	}
+
+	/**
+	 * \brief Writes the settings as space separated 'key=value' pairs.
+	 */
+	static std::string format_settings(const ModelSettings &settings) {
+		std::ostringstream out;
+		out << "propagation=" << propagation_name(settings.propagation)
+			<< " coalesce_bans=" << settings.coalesce_bans
+			<< " ordering=" << ordering_name(settings.ordering)
+			<< " window=" << settings.window
+			<< " layout=" << layout_name(settings.layout);
+		return out.str();
+	}
+
+	/**
+	 * \brief Reads settings from 'key=value' pairs. Unknown keys are skipped, so
+	 * older binaries can read newer tuning files.
+	 */
+	static void parse_settings(std::istream &in, ModelSettings &settings) {
+		std::string field;
+		while (in >> field) {
+			const size_t split = field.find('=');
+			if (split == std::string::npos) continue;
+			const std::string key = field.substr(0, split);
+			const std::string value = field.substr(split + 1);
+
+			if (key == "propagation")
+				settings.propagation = (value == "bitmask") ? Propagation::BITMASK : Propagation::ADJACENCY;
+			else if (key == "coalesce_bans")
+				settings.coalesce_bans = (value == "1");
+			else if (key == "window")
+				settings.window = atoi(value.c_str());
+			else if (key == "ordering")
+				parse_ordering(value, settings.ordering);
+			else if (key == "layout")
+				parse_layout(value, settings.layout);
+		}
+	}
+
+	RuleSetStats compute_rule_set_stats(const int num_patterns,
+		const std::vector<std::vector<int>> &fit_table, const Pair &output_shape) {
+		size_t total_fits = 0;
+		for (const auto& valid_patterns : fit_table)
+			total_fits += valid_patterns.size();
+
+		RuleSetStats stats;
+		stats.num_patterns = num_patterns;
+		stats.fit_density = fit_table.empty() || num_patterns == 0 ? 0.0 :
+			static_cast<double>(total_fits) / fit_table.size() / num_patterns;
+		stats.output_shape = output_shape;
+		return stats;
+	}
+
+	/**
+	 * \return True if the output is no larger than the calibration board.
+	 */
+	static bool small_board(const RuleSetStats &stats) {
+		return stats.output_shape.x <= CALIBRATION_SIZE && stats.output_shape.y <= CALIBRATION_SIZE;
+	}
+
+	/**
+	 * \return True if output rows are wide enough for vertical neighbors to land
+	 * on distant cache lines in row-major order.
+	 */
+	static bool wide_board(const RuleSetStats &stats) {
+		return stats.output_shape.x > CALIBRATION_SIZE;
+	}
+
+	ModelSettings suggest_settings(const RuleSetStats &stats) {
+		// Blocked layouts keep vertical neighbors close on wide boards, and were the
+		// fastest layout at every size in bench_layout.
+		const Layout layout = wide_board(stats) ? Layout::TILED : Layout::ROW_MAJOR;
+
+		// Bitmask propagation costs about N / 64 words per remaining pattern, against
+		// one decrement per fitting pattern for adjacency lists, so it only wins on
+		// small dense rule sets. Dense rule sets also ban many patterns per position
+		// at once, which is when coalescing pays off.
+		const bool dense = stats.fit_density >= 0.1;
+		if (dense && stats.num_patterns <= 64)
+			return ModelSettings(false, Propagation::BITMASK, Ordering::GLOBAL_ENTROPY, 4, false, layout);
+		return ModelSettings(dense, Propagation::ADJACENCY, Ordering::GLOBAL_ENTROPY, 4, false, layout);
+	}
+
+	void candidate_settings(const RuleSetStats &stats, std::vector<ModelSettings> &out) {
+		const ModelSettings suggested = suggest_settings(stats);
+		out.clear();
+		out.push_back(suggested);
+
+		std::vector<ModelSettings> all = {
+			ModelSettings(false, Propagation::ADJACENCY),
+			ModelSettings(true, Propagation::ADJACENCY),
+		};
+
+		// Bitmask propagation is hopeless on large sparse rule sets; don't waste
+		// calibration time on it.
+		if (stats.num_patterns <= 256 || stats.fit_density >= 0.25)
+			all.push_back(ModelSettings(false, Propagation::BITMASK));
+
+		for (ModelSettings settings : all) {
+			if (settings.propagation != suggested.propagation || settings.coalesce_bans != suggested.coalesce_bans) {
+				settings.layout = suggested.layout;
+				out.push_back(settings);
+			}
+		}
+	}
+
+	void candidate_orderings(const RuleSetStats &stats, const ModelSettings &base,
+		std::vector<ModelSettings> &out) {
+		out.clear();
+		out.push_back(base);
+
+		// On small boards a scan over every position costs little next to
+		// propagation, so only the linear scans are worth timing. Larger boards pay
+		// for the global scan on every observation, and for its jumps across memory.
+		std::vector<std::pair<Ordering, int>> orderings;
+		if (small_board(stats)) {
+			orderings = {{Ordering::GLOBAL_ENTROPY, base.window}, {Ordering::SCANLINE, base.window}};
+		} else {
+			orderings = {{Ordering::GLOBAL_ENTROPY, base.window}, {Ordering::FRONTIER, base.window},
+				{Ordering::LOCAL_ENTROPY, 4}, {Ordering::LOCAL_ENTROPY, 8}};
+		}
+
+		for (const auto& ordering : orderings) {
+			if (ordering.first == base.ordering && ordering.second == base.window) continue;
+			ModelSettings settings = base;
+			settings.ordering = ordering.first;
+			settings.window = ordering.second;
+			out.push_back(settings);
+		}
+	}
+
+	void candidate_layouts(const RuleSetStats &stats, const ModelSettings &base,
+		std::vector<ModelSettings> &out) {
+		out.clear();
+		out.push_back(base);
+		if (!wide_board(stats)) return;
+
+		for (int i = 0; i < LAYOUT_COUNT; i++) {
+			if (static_cast<Layout>(i) == base.layout) continue;
+			ModelSettings settings = base;
+			settings.layout = static_cast<Layout>(i);
+			out.push_back(settings);
+		}
+	}
+
+	/**
+	 * \brief The best settings found so far, and how they did on the current
+	 * calibration board. A negative time means they were not timed on it yet.
+	 */
+	struct Calibration {
+		ModelSettings settings;
+		double time = -1;
+		int failed = 0;
+	};
+
+	/**
+	 * \brief Times 'runs' generations of every candidate on the model's current
+	 * board, seeding run i of every candidate with 'seed + i', and keeps the
+	 * fastest of the candidates that fail the fewest runs in 'best'. The first
+	 * candidate is 'best.settings', which is only timed if it wasn't already.
+	 */
+	static void calibrate(Model &model, const std::vector<ModelSettings> &candidates,
+		std::vector<Pair> &overlays, std::vector<int> &counts,
+		std::vector<std::vector<int>> &fit_table, const int runs, const unsigned seed,
+		Calibration &best) {
+		if (candidates.size() == 1) return;
+
+		// Every candidate stops at the first contradiction. Adjacency propagation
+		// lets a contradiction spread over the board while bitmask propagation
+		// contains it, so timing past that point would compare contradiction
+		// handling rather than speed.
+		for (size_t i = best.time < 0 ? 0 : 1; i < candidates.size(); i++) {
+			const ModelSettings& settings = candidates[i];
+			model.settings = settings;
+			model.settings.stop_on_contradiction = true;
+			int failed = 0;
+			const auto start = std::chrono::steady_clock::now();
+			for (int run = 0; run < runs; run++) {
+				srand(seed + run);
+				failed += model.generate(overlays, counts, fit_table) != Status::COMPLETE;
+			}
+			const double time = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+			std::cout << "Tuning: " << format_settings(settings) << " on " << model.wave_shape << " took "
+				<< time << "s, " << failed << "/" << runs << " runs failed" << std::endl;
+
+			// A faster candidate only wins if it fails no more often.
+			if (best.time < 0 || failed < best.failed || (failed == best.failed && time < best.time)) {
+				best.time = time;
+				best.failed = failed;
+				best.settings = settings;
+			}
+		}
+	}
+
+	ModelSettings tune_model(Pair &output_shape, const char dim, const bool periodic,
+		std::vector<Pair> &overlays, std::vector<int> &counts,
+		std::vector<std::vector<int>> &fit_table, const int runs) {
+		const RuleSetStats stats = compute_rule_set_stats(counts.size(), fit_table, output_shape);
+		std::vector<ModelSettings> candidates;
+		candidate_settings(stats, candidates);
+		if (runs <= 0) return candidates[0];
+
+		// Calibrate on a reduced board, reusing one workspace for every candidate.
+		Pair shape = Pair(MIN(output_shape.x, CALIBRATION_SIZE), MIN(output_shape.y, CALIBRATION_SIZE));
+		Model model(shape, counts.size(), overlays.size(), dim, periodic, candidates[0]);
+
+		// Every stage generates the same boards.
+		const unsigned seed = rand();
+		Calibration best;
+		best.settings = candidates[0];
+		calibrate(model, candidates, overlays, counts, fit_table, runs, seed, best);
+		candidate_orderings(stats, best.settings, candidates);
+		calibrate(model, candidates, overlays, counts, fit_table, runs, seed, best);
+
+		// Keep the calibration area about the same, but with rows as wide as the
+		// output's and at least two blocks tall.
+		candidate_layouts(stats, best.settings, candidates);
+		if (candidates.size() > 1) {
+			const int width = MIN(output_shape.x, LAYOUT_CALIBRATION_WIDTH);
+			const int rows = MAX(CALIBRATION_SIZE * CALIBRATION_SIZE / width, 2 * CellLayout::BLOCK + dim - 1);
+			shape = Pair(width, MIN(output_shape.y, rows));
+			model.resize(shape, counts.size(), overlays.size(), dim);
+			best.time = -1;
+			calibrate(model, candidates, overlays, counts, fit_table, runs, seed, best);
+		}
+		srand(seed + runs);
+
+		std::cout << "Tuned: " << format_settings(best.settings) << std::endl;
+		return best.settings;
+	}
+
+	/**
+	 * \return The smallest power of two that is at least 'side' and at least
+	 * CALIBRATION_SIZE.
+	 */
+	static int round_size(const int side) {
+		int size = CALIBRATION_SIZE;
+		while (size < side) size *= 2;
+		return size;
+	}
+
+	TuningKey::TuningKey(uint64_t rule_set_hash, Pair output_shape, bool periodic)
+		: rule_set_hash(rule_set_hash), size_class(round_size(output_shape.x), round_size(output_shape.y)),
+		periodic(periodic) {}
+
+	/**
+	 * \return The start of the tuning file line for the key, up to the settings.
+	 */
+	static std::string format_key(const TuningKey &key) {
+		std::ostringstream out;
+		out << std::hex << key.rule_set_hash << std::dec << " size=" << key.size_class.x << "x"
+			<< key.size_class.y << " periodic=" << key.periodic;
+		return out.str();
+	}
+
+	/**
+	 * \return True if the tuning file line is the entry for 'prefix' (see
+	 * 'format_key').
+	 */
+	static bool matches_key(const std::string &line, const std::string &prefix) {
+		return line.compare(0, prefix.size(), prefix) == 0 &&
+			(line.size() == prefix.size() || line[prefix.size()] == ' ');
+	}
+
+	bool save_tuning(const std::string &filename, const TuningKey &key,
+		const ModelSettings &settings) {
+		const std::string prefix = format_key(key);
+
+		// Keep the entries of every other key.
+		std::vector<std::string> lines;
+		{
+			std::ifstream in(filename);
+			std::string line;
+			while (std::getline(in, line)) {
+				if (!matches_key(line, prefix))
+					lines.push_back(line);
+			}
+		}
+		lines.push_back(prefix + " " + format_settings(settings));
+
+		std::ofstream out(filename);
+		for (const std::string& line : lines)
+			out << line << std::endl;
+		return out.good();
+	}
+
+	bool load_tuning(const std::string &filename, const TuningKey &key,
+		ModelSettings &settings) {
+		const std::string prefix = format_key(key);
+		std::ifstream in(filename);
+		std::string line;
+		while (std::getline(in, line)) {
+			if (matches_key(line, prefix)) {
+				std::istringstream fields(line.substr(prefix.size()));
+				parse_settings(fields, settings);
+				return true;
+			}
+		}
+		return false;
+	}
+}
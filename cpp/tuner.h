@@ -0,0 +1,132 @@
+#pragma once
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "model.h"
+
+namespace wfc
+{
+	/**
+	 * \brief Number of values of 'Ordering' and 'Layout', to loop over all of them.
+	 */
+	const int ORDERING_COUNT = 5;
+	const int LAYOUT_COUNT = 3;
+
+	/**
+	 * \return The name of the ordering, as used in tuning files.
+	 */
+	const char* ordering_name(const Ordering ordering);
+
+	/**
+	 * \return The name of the layout, as used in tuning files.
+	 */
+	const char* layout_name(const Layout layout);
+
+	/**
+	 * \brief Looks up an ordering by name. Returns false if there is no ordering
+	 * with that name, in which case 'ordering' is unchanged.
+	 */
+	bool parse_ordering(const std::string &name, Ordering &ordering);
+
+	/**
+	 * \brief Looks up a layout by name. Returns false if there is no layout with
+	 * that name, in which case 'layout' is unchanged.
+	 */
+	bool parse_layout(const std::string &name, Layout &layout);
+
+	/**
+	 * \brief Summary of a rule set, used to pick which settings are worth
+	 * calibrating.
+	 */
+	struct RuleSetStats {
+		int num_patterns;
+
+		/**
+		 * \brief Average fraction of all patterns allowed by a fit table entry.
+		 */
+		double fit_density;
+
+		Pair output_shape;
+	};
+
+	/**
+	 * \brief Computes the statistics of the rule set described by the fit table.
+	 */
+	RuleSetStats compute_rule_set_stats(const int num_patterns,
+		const std::vector<std::vector<int>> &fit_table, const Pair &output_shape);
+
+	/**
+	 * \return A best guess at the fastest settings, from statistics alone.
+	 */
+	ModelSettings suggest_settings(const RuleSetStats &stats);
+
+	/**
+	 * \brief Stores every propagation mode worth calibrating for this rule set in
+	 * 'out'. The suggested settings always come first.
+	 */
+	void candidate_settings(const RuleSetStats &stats, std::vector<ModelSettings> &out);
+
+	/**
+	 * \brief Stores 'base' with every ordering worth calibrating for this output
+	 * size in 'out', starting with 'base' itself. Small boards only try the
+	 * linear scans, while larger ones also try the orderings that stay near the
+	 * last observation.
+	 */
+	void candidate_orderings(const RuleSetStats &stats, const ModelSettings &base,
+		std::vector<ModelSettings> &out);
+
+	/**
+	 * \brief Stores 'base' with every layout worth calibrating for this output
+	 * size in 'out', starting with 'base' itself. Blocked layouts are only tried
+	 * when rows are wider than the calibration board.
+	 */
+	void candidate_layouts(const RuleSetStats &stats, const ModelSettings &base,
+		std::vector<ModelSettings> &out);
+
+	/**
+	 * \brief Picks the fastest settings by timing 'runs' generations of each
+	 * candidate, one stage at a time: first the propagation mode, then the
+	 * ordering and then the layout, each on top of the previous winners.
+	 * Propagation and ordering are timed on a board of at most 64 x 64. Layouts
+	 * are timed on a board as wide as the output (up to 1024), so rows have the
+	 * same stride. Every candidate generates the same seeded boards, up to their
+	 * first contradiction, and candidates that fail more runs lose.
+	 */
+	ModelSettings tune_model(Pair &output_shape, const char dim, const bool periodic,
+		std::vector<Pair> &overlays, std::vector<int> &counts,
+		std::vector<std::vector<int>> &fit_table, const int runs=3);
+
+	/**
+	 * \brief Identifies a tuning file entry. Tuned settings depend on the output
+	 * size and on whether it is periodic, not just on the rule set, so outputs
+	 * share an entry only if each side rounds up to the same power of two (at
+	 * least 64) and they agree on periodicity.
+	 */
+	struct TuningKey {
+		/**
+		 * \brief See 'hash_rule_set'.
+		 */
+		uint64_t rule_set_hash;
+
+		Pair size_class;
+		bool periodic;
+
+	public:
+		TuningKey(uint64_t rule_set_hash=0, Pair output_shape=Pair(), bool periodic=false);
+	};
+
+	/**
+	 * \brief Stores settings for the key in a tuning file, replacing any previous
+	 * entry for the same key. A tuning file holds one line per key: the rule set
+	 * hash, 'size=WxH' and 'periodic=0/1', followed by 'key=value' settings.
+	 */
+	bool save_tuning(const std::string &filename, const TuningKey &key,
+		const ModelSettings &settings);
+
+	/**
+	 * \brief Loads the settings stored for the key. Returns false if the file has
+	 * no entry for it, in which case 'settings' is unchanged.
+	 */
+	bool load_tuning(const std::string &filename, const TuningKey &key,
+		ModelSettings &settings);
+}
@@ -2,4 +2,7 @@
 
 #include "model.h"
 #include "wfc_util.h"
+#include "pattern_set.h"
 #include "output.h"
+#include "grid.h"
+#include "tuner.h"
@@ -1,4 +1,6 @@
 #include "wfc_util.h"
+#include "pattern_set.h"
+#include <cstring>
 
 namespace wfc
 {
@@ -9,8 +11,6 @@ namespace wfc
 		return os;
 	}
 
-	Waveform::Waveform(const Pair pos, const int state): pos(pos), state(state){}
-
 	BGR::BGR(const uchar b, const uchar g, const uchar r) : b(b), g(g), r(r) {}
 
 	BGR BGR::operator/(const int val) const
@@ -47,14 +47,15 @@ namespace wfc
 		out.emplace_back(0, -1);
 	}
 
-	void generate_fit_table(const std::vector<cv::Mat> &patterns, const std::vector<Pair> &overlays, 
+	void generate_fit_table(const PatternSet &patterns, const std::vector<Pair> &overlays, 
 		const int dim, std::vector<std::vector<int>> &fit_table) {
+		CV_Assert(patterns.dim == dim);
 		size_t num_patterns = patterns.size();
-		for (const cv::Mat& center_pattern : patterns) {
-			for (Pair overlay : overlays) {
+		for (size_t center_pattern = 0; center_pattern < num_patterns; center_pattern++) {
+			for (const Pair& overlay : overlays) {
 				std::vector<int> valid_patterns;
 				for (size_t i = 0; i < num_patterns; i++) {
-					if (overlay_fit(center_pattern, patterns[i], overlay, dim))
+					if (overlay_fit(patterns, center_pattern, i, overlay))
 					{
 						valid_patterns.push_back(i);
 					}
@@ -64,49 +65,54 @@ namespace wfc
 		}
 	}
 
-	bool overlay_fit(const cv::Mat &patt1, const cv::Mat &patt2, Pair &overlay, char dim) {
-		CV_Assert(patt1.depth() == patt2.depth() &&
-			patt1.depth() == CV_8U &&
-			patt1.channels() == patt2.channels() &&
-			patt1.cols == patt2.cols && 
-			patt1.rows == patt2.rows &&
-			patt1.cols == dim &&
-			patt1.rows == dim);
-
+	bool overlay_fit(const PatternSet &patterns, const int patt1, const int patt2, const Pair &overlay) {
 		/* 
 		 * Computes the range of indices at which to patt1 overlaps with patt2. Indices
 		 * are computed from the given overlay and are in terms of patt1 indexing.
 		 * To convert to patt2 indexing, subtract by the row/col shifts (shown blow).
 		 */
 		
-		const int channels = patt1.channels();
-		int row_shift = overlay.y, col_shift = overlay.x;
+		const int dim = patterns.dim;
+		const int row_shift = overlay.y, col_shift = overlay.x;
 
 		const int row_start = MAX(row_shift, 0);
 		const int row_end = MIN(row_shift + dim - 1, dim - 1) + 1;
-		int col_start = MAX(col_shift, 0);
-		int col_end = MIN(col_shift + dim - 1, dim - 1) + 1;
-
-		col_start *= channels;
-		col_end *= channels;
-		col_shift *= channels;
+		const int col_start = MAX(col_shift, 0);
+		const int col_end = MIN(col_shift + dim - 1, dim - 1) + 1;
+		const int width = col_end - col_start;
+		if (width <= 0) return true;
 
 		// Row equivalent for patt2 is {value} - row_shift
 		// Col equivalent for patt2 is {value} - col_shift
 
-		// Checks if the overlapping pixels are equal.
-		int i, j;
-		const uchar* p1; const uchar* p2;
-		bool matching = true;
-		for (i = row_start; i < row_end && matching; i++) {
-			p1 = patt1.ptr<uchar>(i);
-			p2 = patt2.ptr<uchar>(i - row_shift);
-			for (j = col_start; j < col_end && matching; j++) {
-				matching = p1[j] == p2[j-col_shift];
+		// Offsets and lengths below are in bytes.
+		const int bytes = patterns.index_bytes;
+		const int row_bytes = dim * bytes;
+		const int width_bytes = width * bytes;
+
+		if (patterns.packed()) {
+			// Line up the overlapping columns of both rows at byte 0, and compare them
+			// all at once.
+			const uint64_t* rows1 = patterns.packed_rows(patt1);
+			const uint64_t* rows2 = patterns.packed_rows(patt2);
+			const uint64_t mask = width_bytes == 8 ? ~0ull : (1ull << (8 * width_bytes)) - 1;
+			const int shift1 = 8 * bytes * col_start, shift2 = 8 * bytes * (col_start - col_shift);
+			for (int i = row_start; i < row_end; i++) {
+				if (((rows1[i] >> shift1) ^ (rows2[i - row_shift] >> shift2)) & mask)
+					return false;
 			}
+			return true;
 		}
 
-		return matching;
+		// Checks if the overlapping pixels are equal.
+		const uint8_t* p1 = patterns.pattern(patt1);
+		const uint8_t* p2 = patterns.pattern(patt2);
+		for (int i = row_start; i < row_end; i++) {
+			if (memcmp(&p1[i * row_bytes + col_start * bytes],
+					&p2[(i - row_shift) * row_bytes + (col_start - col_shift) * bytes], width_bytes) != 0)
+				return false;
+		}
+		return true;
 	}
 
 	int rand_int(const int max_val) {
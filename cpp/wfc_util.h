@@ -4,6 +4,8 @@
 
 namespace wfc
 {
+	struct PatternSet;
+
 	/**
 	 * \brief Represents a Pair of integral values.
 	 */
@@ -30,17 +32,6 @@ namespace wfc
 		inline bool operator<(const Pair& other) const;
 	};
 
-	/**
-	 * \brief Represents a wave state at position 'Pair(x,y)' in state 'state'
-	 */
-	struct Waveform
-	{
-		Pair pos; int state;
-
-	public:
-		Waveform(Pair pos = { 0,0 }, int state = 0);
-	};
-
 	/**
 	 * \brief Represents a pixel color value
 	 */
@@ -77,13 +68,13 @@ namespace wfc
 	 * \brief Given the internal set of patterns/states, generates the overlay
 	 * constraints (can be/cannot be overlayed) for every Pair of states.
 	 */
-	void generate_fit_table(const std::vector<cv::Mat> &patterns, const std::vector<Pair> &overlays, 
+	void generate_fit_table(const PatternSet &patterns, const std::vector<Pair> &overlays, 
 		const int dim, std::vector<std::vector<int>> &fit_table);
 
 	/**
 	 * \return True if we can lay patt2 on patt1 with the given overlay position
 	 */
-	bool overlay_fit(const cv::Mat &patt1, const cv::Mat &patt2, Pair &overlay, char dim);
+	bool overlay_fit(const PatternSet &patterns, const int patt1, const int patt2, const Pair &overlay);
 
 	/**
 	 * \return A random integer within [0, max_val)
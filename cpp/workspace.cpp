@@ -0,0 +1,92 @@
+#include "workspace.h"
+#include <cstdlib>
+#include <sys/mman.h>
+#include <unistd.h>
+
+namespace wfc
+{
+	// Allocations below this size are not worth a dedicated mapping.
+	static const size_t HUGE_PAGE_THRESHOLD = 2 << 20;
+
+	/**
+	 * \brief Writes to one byte per page so the kernel backs the whole range now.
+	 */
+	static void prefault_pages(void* ptr, size_t bytes) {
+		const size_t page = sysconf(_SC_PAGESIZE);
+		volatile char* p = static_cast<char*>(ptr);
+		for (size_t offset = 0; offset < bytes; offset += page)
+			p[offset] = 0;
+	}
+
+	/**
+	 * \return True if this allocation gets its own mapping rather than heap memory.
+	 */
+	static bool uses_mapping(size_t bytes, const WorkspaceOptions& options) {
+		return options.huge_pages && bytes >= HUGE_PAGE_THRESHOLD;
+	}
+
+	static void* map_pages(size_t bytes, const WorkspaceOptions& options) {
+		int flags = MAP_PRIVATE | MAP_ANONYMOUS;
+#ifdef MAP_POPULATE
+		if (options.prefault && !options.huge_pages) flags |= MAP_POPULATE;
+#endif
+		void* ptr = mmap(nullptr, bytes, PROT_READ | PROT_WRITE, flags, -1, 0);
+		if (ptr == MAP_FAILED) throw std::bad_alloc();
+
+#ifdef MADV_HUGEPAGE
+		// Must be advised before the pages are touched to get huge pages on first fault.
+		if (options.huge_pages) madvise(ptr, bytes, MADV_HUGEPAGE);
+#endif
+		if (options.prefault && options.huge_pages) prefault_pages(ptr, bytes);
+		return ptr;
+	}
+
+	WorkspaceOptions::WorkspaceOptions(bool huge_pages, bool prefault, Arena* arena) :
+	huge_pages(huge_pages), prefault(prefault), arena(arena) {}
+
+	bool WorkspaceOptions::operator==(const WorkspaceOptions& other) const {
+		return huge_pages == other.huge_pages && prefault == other.prefault && arena == other.arena;
+	}
+
+	Arena::Arena(size_t capacity, const WorkspaceOptions& options) :
+	capacity_(capacity), mapped_(capacity > 0) {
+		// The arena itself is always one mapping; 'arena' in options is ignored here.
+		WorkspaceOptions map_options(options.huge_pages, options.prefault);
+		base_ = mapped_ ? static_cast<char*>(map_pages(capacity, map_options)) : nullptr;
+	}
+
+	Arena::~Arena() {
+		if (mapped_) munmap(base_, capacity_);
+	}
+
+	void* Arena::allocate(size_t bytes, size_t align) {
+		const size_t start = (used_ + align - 1) / align * align;
+		if (start + bytes > capacity_) throw std::bad_alloc();
+		used_ = start + bytes;
+		return base_ + start;
+	}
+
+	void Arena::reset() {
+		used_ = 0;
+	}
+
+	void* workspace_allocate(size_t bytes, const WorkspaceOptions& options) {
+		if (options.arena)
+			return options.arena->allocate(bytes, alignof(std::max_align_t));
+		if (uses_mapping(bytes, options))
+			return map_pages(bytes, options);
+
+		void* ptr = ::operator new(bytes);
+		if (options.prefault) prefault_pages(ptr, bytes);
+		return ptr;
+	}
+
+	void workspace_deallocate(void* ptr, size_t bytes, const WorkspaceOptions& options) {
+		if (options.arena) return;	// Reclaimed all at once by Arena::reset.
+		if (uses_mapping(bytes, options)) {
+			munmap(ptr, bytes);
+			return;
+		}
+		::operator delete(ptr);
+	}
+}
@@ -0,0 +1,120 @@
+#pragma once
+#include <cstddef>
+#include <new>
+#include <type_traits>
+#include <vector>
+
+namespace wfc
+{
+	class Arena;
+
+	/**
+	 * \brief Describes how workspace buffers are backed in memory.
+	 */
+	struct WorkspaceOptions {
+		/**
+		 * \brief Back large buffers with huge pages (transparent huge pages via
+		 * madvise) instead of the default heap.
+		 */
+		bool huge_pages;
+
+		/**
+		 * \brief Touch every page when a buffer is allocated, so that page faults
+		 * happen up front instead of during generation.
+		 */
+		bool prefault;
+
+		/**
+		 * \brief If set, all buffers are carved out of this arena instead. The arena
+		 * must outlive every container that allocates from it.
+		 */
+		Arena* arena;
+
+	public:
+		WorkspaceOptions(bool huge_pages=false, bool prefault=false, Arena* arena=nullptr);
+		bool operator==(const WorkspaceOptions& other) const;
+	};
+
+	/**
+	 * \brief A fixed-capacity bump allocator over a single mapped region. Memory is
+	 * only returned to the arena on 'reset', so it suits workspaces that are sized
+	 * once (see 'Model::reserve') and then reused.
+	 */
+	class Arena {
+	public:
+		Arena(size_t capacity, const WorkspaceOptions& options=WorkspaceOptions());
+		~Arena();
+		Arena(const Arena&) = delete;
+		Arena& operator=(const Arena&) = delete;
+
+		/**
+		 * \return A pointer to 'bytes' bytes of memory aligned to 'align'. Throws
+		 * std::bad_alloc if the arena is exhausted.
+		 */
+		void* allocate(size_t bytes, size_t align);
+
+		/**
+		 * \brief Releases every allocation at once. Containers using the arena must
+		 * be destroyed (or never touched again) before calling this.
+		 */
+		void reset();
+
+		size_t used() const { return used_; }
+		size_t capacity() const { return capacity_; }
+
+	private:
+		char* base_;
+		size_t capacity_;
+		size_t used_ = 0;
+		bool mapped_;
+	};
+
+	/**
+	 * \return A pointer to 'bytes' bytes of workspace memory backed as described by
+	 * 'options'.
+	 */
+	void* workspace_allocate(size_t bytes, const WorkspaceOptions& options);
+
+	/**
+	 * \brief Returns memory from 'workspace_allocate'. 'bytes' and 'options' must
+	 * match the original allocation.
+	 */
+	void workspace_deallocate(void* ptr, size_t bytes, const WorkspaceOptions& options);
+
+	/**
+	 * \brief Standard allocator over 'workspace_allocate', so that any std container
+	 * can be backed by huge pages or an arena.
+	 */
+	template <typename T>
+	class WorkspaceAllocator {
+	public:
+		typedef T value_type;
+		typedef std::true_type propagate_on_container_copy_assignment;
+		typedef std::true_type propagate_on_container_move_assignment;
+		typedef std::true_type propagate_on_container_swap;
+
+		WorkspaceOptions options;
+
+		WorkspaceAllocator(const WorkspaceOptions& options=WorkspaceOptions()) : options(options) {}
+
+		template <typename U>
+		WorkspaceAllocator(const WorkspaceAllocator<U>& other) : options(other.options) {}
+
+		T* allocate(size_t n) {
+			return static_cast<T*>(workspace_allocate(n * sizeof(T), options));
+		}
+
+		void deallocate(T* ptr, size_t n) {
+			workspace_deallocate(ptr, n * sizeof(T), options);
+		}
+
+		template <typename U>
+		bool operator==(const WorkspaceAllocator<U>& other) const { return options == other.options; }
+
+		template <typename U>
+		bool operator!=(const WorkspaceAllocator<U>& other) const { return !(options == other.options); }
+	};
+
+	template <typename T>
+	using workspace_vector = std::vector<T, WorkspaceAllocator<T>>;
+}